@@ -0,0 +1,65 @@
+#ifndef _WHITE_OS_ACPI_H
+#define _WHITE_OS_ACPI_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+struct acpi_rsdp {
+    char signature[8];
+    uint8_t checksum;
+    char oem_id[6];
+    uint8_t revision;
+    uint32_t rsdt_address;
+    uint32_t length;
+    uint64_t xsdt_address;
+    uint8_t extended_checksum;
+    uint8_t reserved[3];
+} __attribute__((packed));
+
+struct acpi_sdt_header {
+    char signature[4];
+    uint32_t length;
+    uint8_t revision;
+    uint8_t checksum;
+    char oem_id[6];
+    char oem_table_id[8];
+    uint32_t oem_revision;
+    uint32_t creator_id;
+    uint32_t creator_revision;
+} __attribute__((packed));
+
+struct acpi_gas {
+    uint8_t address_space_id;
+    uint8_t register_bit_width;
+    uint8_t register_bit_offset;
+    uint8_t access_size;
+    uint64_t address;
+} __attribute__((packed));
+
+#define ACPI_GAS_SYSTEM_MEMORY 0
+
+struct acpi_hpet {
+    struct acpi_sdt_header header;
+    uint32_t event_timer_block_id;
+    struct acpi_gas base_address;
+    uint8_t hpet_number;
+    uint16_t minimum_tick;
+    uint8_t page_protection;
+} __attribute__((packed));
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * Returns the first table with the given four-character signature and a
+ * valid checksum, found through the RSDP Limine hands over, or NULL.
+ * Tables are accessed through the HHDM, so the VMM must be up.
+ */
+const struct acpi_sdt_header *acpi_find_table(const char *signature);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
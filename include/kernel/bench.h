@@ -0,0 +1,21 @@
+#ifndef _WHITE_OS_BENCH_H
+#define _WHITE_OS_BENCH_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+/*
+ * In-kernel microbenchmarks, built with KERNEL_BENCH (make KERNEL_BENCH=1)
+ * and run from kernel_main once memory management is up. Results are
+ * reported in bytes or operations per 1000 TSC cycles.
+ */
+
+#define BENCH_MIN_SIZE 8
+#define BENCH_MAX_SIZE (16 * 1024 * 1024)
+#define BENCH_BYTES_PER_SIZE (64 * 1024 * 1024)
+#define BENCH_FORMAT_ITERATIONS 100000
+
+void bench_memory(void);
+void bench_format(void);
+
+#endif
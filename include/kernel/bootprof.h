@@ -0,0 +1,36 @@
+#ifndef _WHITE_OS_BOOTPROF_H
+#define _WHITE_OS_BOOTPROF_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+/*
+ * Boot phase timing. boot_phase(name) closes the phase in progress and
+ * opens the next one; timestamps are raw TSC reads, so phases can start
+ * long before the clock is calibrated. Time before kernel_main is taken
+ * from the TSC value at entry, which counts from reset.
+ *
+ * bootprof_finish prints a breakdown sorted by duration to the console
+ * and writes one machine-readable line to COM1:
+ *
+ *   BOOTPROF {"boot_time":...,"tsc_hz":...,"total_ns":...,"phases":[...]}
+ *
+ * Phase names are written into the JSON as they are, so they should be
+ * plain identifiers.
+ */
+#define BOOTPROF_MAX_PHASES 32
+#define BOOTPROF_PRE_KERNEL "pre_kernel"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+void bootprof_initialize(void);
+void boot_phase(const char *name);
+void bootprof_finish(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
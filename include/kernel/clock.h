@@ -0,0 +1,45 @@
+#ifndef _WHITE_OS_CLOCK_H
+#define _WHITE_OS_CLOCK_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+/*
+ * Monotonic kernel clock. The TSC is used when CPUID reports it as
+ * invariant; its frequency comes from CPUID leaf 0x15 when enumerated,
+ * otherwise it is calibrated against the HPET, or the PIT if there is
+ * no HPET. Without an invariant TSC the HPET main counter is read
+ * directly, and only as a last resort is an unreliable TSC used.
+ *
+ * Counts are converted as (delta * mult) >> CLOCK_SHIFT with a 64x64 to
+ * 128-bit multiply, so reading the clock never divides.
+ */
+#define CLOCK_SHIFT 32
+#define CLOCK_CALIBRATION_MS 10
+#define CLOCK_CALIBRATION_ROUNDS 3
+
+typedef enum clock_source {
+    CLOCK_SOURCE_NONE,
+    CLOCK_SOURCE_TSC,
+    CLOCK_SOURCE_HPET
+} clock_source;
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+void clock_initialize(void);
+clock_source clock_get_source(void);
+uint64_t clock_tsc_frequency(void);
+
+/* Nanoseconds since clock_initialize; 0 before it has run. */
+uint64_t ktime_ns(void);
+
+/* Converts a TSC interval, e.g. taken before the clock was set up. */
+uint64_t clock_cycles_to_ns(uint64_t cycles);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,41 @@
+#ifndef _WHITE_OS_CONSOLE_H
+#define _WHITE_OS_CONSOLE_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+/*
+ * Output queue in front of the serial port and the framebuffer terminal.
+ * console_queue_write copies the text into a lock-free multi-producer
+ * ring and returns without touching either device; console_drain, run
+ * from the idle loop or a console worker, writes queued text out in
+ * batches. Until console_initialize has run, and after
+ * console_panic_flush, output is written synchronously.
+ */
+
+#define CONSOLE_QUEUE_SLOTS 1024
+#define CONSOLE_SLOT_DATA 52
+#define CONSOLE_MAX_RESERVE 64
+#define CONSOLE_BLOCK_SPINS (1 << 20)
+
+typedef enum console_overflow_policy {
+    CONSOLE_OVERFLOW_DROP,
+    CONSOLE_OVERFLOW_BLOCK
+} console_overflow_policy;
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+void console_initialize(void);
+void console_queue_write(const char *data, size_t size);
+size_t console_drain(void);
+void console_set_overflow_policy(console_overflow_policy policy);
+uint64_t console_dropped_bytes(void);
+void console_panic_flush(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
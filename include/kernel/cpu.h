@@ -0,0 +1,92 @@
+#ifndef _WHITE_OS_CPU_H
+#define _WHITE_OS_CPU_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+#define CPUID_1_EDX_SSE2 (1u << 26)
+#define CPUID_7_EBX_ERMS (1u << 9)
+#define CPUID_7_EDX_FSRM (1u << 4)
+#define CPUID_80000001_EDX_RDTSCP (1u << 27)
+#define CPUID_80000007_EDX_INVARIANT_TSC (1u << 8)
+
+#define MSR_TSC_AUX 0xC0000103
+
+static inline void cpuid(uint32_t leaf, uint32_t subleaf,
+                         uint32_t *eax, uint32_t *ebx, uint32_t *ecx, uint32_t *edx)
+{
+    __asm__ __volatile__("cpuid"
+                         : "=a"(*eax), "=b"(*ebx), "=c"(*ecx), "=d"(*edx)
+                         : "a"(leaf), "c"(subleaf));
+}
+
+static inline uint64_t rdtsc(void)
+{
+    uint32_t low, high;
+    __asm__ __volatile__("rdtsc" : "=a"(low), "=d"(high));
+    return ((uint64_t)high << 32) | low;
+}
+
+static inline uint64_t rdtscp(uint32_t *aux)
+{
+    uint32_t low, high;
+    __asm__ __volatile__("rdtscp" : "=a"(low), "=d"(high), "=c"(*aux));
+    return ((uint64_t)high << 32) | low;
+}
+
+static inline void outb(uint16_t port, uint8_t value)
+{
+    __asm__ __volatile__("outb %0, %1" : : "a"(value), "Nd"(port));
+}
+
+static inline uint8_t inb(uint16_t port)
+{
+    uint8_t ret;
+    __asm__ __volatile__("inb %1, %0" : "=a"(ret) : "Nd"(port));
+    return ret;
+}
+
+static inline void outw(uint16_t port, uint16_t value)
+{
+    __asm__ __volatile__("outw %0, %1" : : "a"(value), "Nd"(port));
+}
+
+static inline uint16_t inw(uint16_t port)
+{
+    uint16_t ret;
+    __asm__ __volatile__("inw %1, %0" : "=a"(ret) : "Nd"(port));
+    return ret;
+}
+
+static inline void outl(uint16_t port, uint32_t value)
+{
+    __asm__ __volatile__("outl %0, %1" : : "a"(value), "Nd"(port));
+}
+
+static inline uint32_t inl(uint16_t port)
+{
+    uint32_t ret;
+    __asm__ __volatile__("inl %1, %0" : "=a"(ret) : "Nd"(port));
+    return ret;
+}
+
+/* Writes size bytes to one port with a single string instruction. */
+static inline void outsb(uint16_t port, const void *data, size_t size)
+{
+    __asm__ __volatile__("rep outsb" : "+S"(data), "+c"(size) : "d"(port) : "memory");
+}
+
+/* A write to the unused POST port gives slow devices such as the PIC time to settle. */
+static inline void io_wait(void)
+{
+    outb(0x80, 0);
+}
+
+static inline void wrmsr(uint32_t msr, uint64_t value)
+{
+    __asm__ __volatile__("wrmsr"
+                         :
+                         : "c"(msr), "a"((uint32_t)value), "d"((uint32_t)(value >> 32)));
+}
+
+#endif
@@ -3,6 +3,9 @@
 
 #include <stdint.h>
 #include <stddef.h>
+#include <stdio.h>
+
+#include <kernel/console.h>
 
 #define DEBUG_ERROR   0
 #define DEBUG_WARN    1
@@ -30,13 +33,23 @@
 #define ASSERT(condition) \
     do { \
         if (!(condition)) { \
+            console_panic_flush(); \
             debug_printf("ASSERT FAILED: %s at %s:%d\n", \
                         #condition, __FILE__, __LINE__); \
             asm volatile ("cli; hlt"); \
         } \
     } while (0)
 
+#define HEX_DUMP_BYTES_PER_LINE 16
+
+/*
+ * hex_dump writes to the debug console; hex_dump_to writes to any printf
+ * sink. Lines are labelled with the address of their first byte, and
+ * runs of lines identical to the one before are collapsed into a single
+ * "*" line.
+ */
 void hex_dump(const void *data, size_t size);
+void hex_dump_to(printf_callback_t callback, void *ctx, const void *data, size_t size);
 const char *debug_level_string(int level);
 void debug_printf(const char *fmt, ...);
 
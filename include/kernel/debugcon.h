@@ -0,0 +1,46 @@
+#ifndef _WHITE_OS_DEBUGCON_H
+#define _WHITE_OS_DEBUGCON_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdarg.h>
+
+/*
+ * Destination for console and debug output, picked at boot with
+ * debugcon=serial|e9|virtio on the kernel command line. e9 is the
+ * Bochs/QEMU debug port, written with one rep outsb per write; virtio
+ * hands whole buffers to a virtio console. Output goes to COM1 until
+ * debugcon_initialize runs, and whenever the requested backend is
+ * missing.
+ */
+#define DEBUGCON_E9_PORT 0xE9
+#define DEBUGCON_WRITER_SIZE 1024
+
+typedef enum debugcon_backend {
+    DEBUGCON_SERIAL,
+    DEBUGCON_E9,
+    DEBUGCON_VIRTIO
+} debugcon_backend;
+
+/* Same as serial_writer, but flushing to the selected backend. */
+typedef struct debugcon_writer {
+    size_t length;
+    char buffer[DEBUGCON_WRITER_SIZE];
+} debugcon_writer;
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+void debugcon_initialize(void);
+debugcon_backend debugcon_get_backend(void);
+void debugcon_write(const char *data, size_t size);
+void debugcon_vprintf(const char *fmt, va_list args);
+void debugcon_writer_write(void *ctx, const char *data, size_t size);
+void debugcon_writer_flush(debugcon_writer *writer);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
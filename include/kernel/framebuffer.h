@@ -0,0 +1,45 @@
+#ifndef _WHITEOS_FRAMEBUFFER_H
+#define _WHITEOS_FRAMEBUFFER_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <limine.h>
+
+#include <kernel/font.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Largest expanded glyph row: eight 32-bit pixels. */
+#define FB_GLYPH_ROW_BYTES (FONT_WIDTH * 4)
+
+typedef uint8_t fb_glyph_rows[256][FB_GLYPH_ROW_BYTES];
+
+/*
+ * Rendering primitives for one pixel format. Colors are passed as
+ * 0xRRGGBB and converted to the framebuffer's channel layout; the glyph
+ * rows table maps each 8-bit font row to its expanded pixels for one
+ * foreground/background pair, as built by expand_glyph_rows. fill_rect
+ * may use non-temporal stores for large fills when streaming is set,
+ * which callers pass only for memory that is not read back, such as the
+ * framebuffer itself.
+ */
+struct fb_renderer {
+    const char *name;
+    size_t bytes_per_pixel;
+    uint32_t (*pack)(uint32_t rgb);
+    void (*expand_glyph_rows)(fb_glyph_rows rows, uint32_t fg, uint32_t bg);
+    void (*draw_glyph)(uint8_t *dst, uint64_t pitch, const uint8_t *glyph, const fb_glyph_rows rows);
+    void (*fill_rect)(uint8_t *dst, uint64_t pitch, size_t width, size_t height, uint32_t rgb,
+                      bool streaming);
+};
+
+/* Returns NULL if the framebuffer's pixel format is not supported. */
+const struct fb_renderer *fb_select_renderer(const struct limine_framebuffer *fb);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,42 @@
+#ifndef _WHITE_OS_HEAPPROF_H
+#define _WHITE_OS_HEAPPROF_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+/*
+ * Kernel heap profiling, enabled by building with KMALLOC_PROFILE
+ * (make KMALLOC_PROFILE=1). Every kmalloc family call records its call
+ * site, size and TSC timestamp; without the flag the hooks expand to
+ * nothing.
+ */
+
+#define HEAP_PROFILE_MAX_ALLOCATIONS 8192
+#define HEAP_PROFILE_MAX_LIVE (HEAP_PROFILE_MAX_ALLOCATIONS / 4 * 3)
+#define HEAP_PROFILE_MAX_SITES 512
+#define HEAP_PROFILE_HISTOGRAM_BUCKETS 16
+
+#ifdef KMALLOC_PROFILE
+
+void heap_profile_record_alloc(void *ptr, size_t size, void *site);
+void heap_profile_record_free(void *ptr);
+void heap_profile_mark(void);
+void heap_profile_dump(void);
+void heap_profile_leak_report(void);
+
+#define HEAP_PROFILE_ALLOC(ptr, size) \
+    heap_profile_record_alloc((ptr), (size), __builtin_return_address(0))
+#define HEAP_PROFILE_FREE(ptr) heap_profile_record_free(ptr)
+
+#else
+
+inline void heap_profile_mark(void) {}
+inline void heap_profile_dump(void) {}
+inline void heap_profile_leak_report(void) {}
+
+#define HEAP_PROFILE_ALLOC(ptr, size) do { } while (0)
+#define HEAP_PROFILE_FREE(ptr) do { } while (0)
+
+#endif
+
+#endif
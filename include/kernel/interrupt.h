@@ -1,4 +1,61 @@
 #ifndef _WHITE_OS_INTERRUPT_H
 #define _WHITE_OS_INTERRUPT_H 
 
-#endif
\ No newline at end of file
+#include <stdint.h>
+#include <stdbool.h>
+
+/*
+ * Legacy PIC interrupts, remapped to vectors IRQ_BASE to IRQ_BASE + 15.
+ * All lines start masked; irq_register installs a handler and unmasks
+ * its line. Handlers run with interrupts disabled and the end of
+ * interrupt is sent after they return.
+ */
+#define IRQ_BASE 0x20
+#define IRQ_COUNT 16
+#define IRQ_CASCADE 2
+#define IRQ_COM1 4
+
+#define RFLAGS_IF (1u << 9)
+
+typedef void (*irq_handler_t)(void);
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+void interrupt_initialize(void);
+void irq_register(uint8_t irq, irq_handler_t handler);
+void irq_mask(uint8_t irq);
+void irq_unmask(uint8_t irq);
+
+#ifdef __cplusplus
+}
+#endif
+
+static inline void interrupts_enable(void) {
+    __asm__ __volatile__("sti" ::: "memory");
+}
+
+/* Disables interrupts and returns the previous RFLAGS for interrupt_restore. */
+static inline uint64_t interrupt_save(void) {
+    uint64_t flags;
+    __asm__ __volatile__("pushfq; popq %0; cli" : "=r"(flags) : : "memory");
+    return flags;
+}
+
+static inline void interrupt_restore(uint64_t flags) {
+    if (flags & RFLAGS_IF) {
+        __asm__ __volatile__("sti" ::: "memory");
+    }
+}
+
+/*
+ * Called with interrupts disabled after finding nothing to do: enables
+ * them and halts in one step, so an interrupt arriving in between still
+ * wakes the CPU. Interrupts are disabled again on return.
+ */
+static inline void interrupt_wait(void) {
+    __asm__ __volatile__("sti; hlt; cli" ::: "memory");
+}
+
+#endif
@@ -0,0 +1,434 @@
+#ifndef _WHITE_OS_KFMT_H
+#define _WHITE_OS_KFMT_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdio.h>
+
+/*
+ * Type-safe kernel formatting. The format string is a template argument
+ * that is parsed at compile time, so every call site gets its own
+ * unrolled sequence of literal writes and argument conversions, and a
+ * placeholder that does not fit its argument is a compile error:
+ *
+ *   kfmt::print<"{} regions, first at {:p}\n">(count, base);
+ *
+ * Placeholders are {} or {:[fill][<|>][0][width][type]} with type one of
+ * d, x, X, p, c, s. {{ and }} produce literal braces. Output goes to the
+ * same printf_callback_t sinks as vcbprintf.
+ */
+
+namespace kfmt
+{
+
+template <size_t N>
+struct FixedString
+{
+  char data[N]{};
+
+  consteval FixedString(const char (&str)[N])
+  {
+    for (size_t i = 0; i < N; i++)
+    {
+      data[i] = str[i];
+    }
+  }
+
+  static constexpr size_t length = N - 1;
+};
+
+enum class Type : uint8_t
+{
+  Default,
+  Decimal,
+  Hex,
+  HexUpper,
+  Pointer,
+  Char,
+  String
+};
+
+struct Spec
+{
+  Type type = Type::Default;
+  char fill = ' ';
+  bool left = false;
+  uint8_t width = 0;
+};
+
+struct Op
+{
+  bool is_arg = false;
+  size_t start = 0;
+  size_t length = 0;
+  size_t arg = 0;
+  Spec spec;
+};
+
+void unterminated_placeholder_in_format_string();
+void unmatched_closing_brace_in_format_string();
+void invalid_placeholder_in_format_string();
+
+template <size_t N>
+struct Parsed
+{
+  Op ops[N > 0 ? N : 1];
+  size_t op_count = 0;
+  size_t arg_count = 0;
+};
+
+template <FixedString Fmt>
+consteval auto parse()
+{
+  constexpr size_t length = decltype(Fmt)::length;
+  Parsed<length> parsed;
+  const char *s = Fmt.data;
+  size_t i = 0;
+
+  while (i < length)
+  {
+    if (s[i] == '{' && i + 1 < length && s[i + 1] == '{')
+    {
+      parsed.ops[parsed.op_count++] = Op{false, i, 1, 0, Spec{}};
+      i += 2;
+    }
+    else if (s[i] == '}')
+    {
+      if (i + 1 >= length || s[i + 1] != '}')
+        unmatched_closing_brace_in_format_string();
+      parsed.ops[parsed.op_count++] = Op{false, i, 1, 0, Spec{}};
+      i += 2;
+    }
+    else if (s[i] == '{')
+    {
+      Spec spec;
+      i++;
+      if (i < length && s[i] == ':')
+      {
+        i++;
+        if (i + 1 < length && (s[i + 1] == '<' || s[i + 1] == '>'))
+        {
+          spec.fill = s[i];
+          spec.left = s[i + 1] == '<';
+          i += 2;
+        }
+        else if (i < length && (s[i] == '<' || s[i] == '>'))
+        {
+          spec.left = s[i] == '<';
+          i++;
+        }
+        if (i < length && s[i] == '0')
+        {
+          spec.fill = '0';
+          i++;
+        }
+        size_t width = 0;
+        while (i < length && s[i] >= '0' && s[i] <= '9')
+        {
+          width = width * 10 + (s[i++] - '0');
+        }
+        if (width > 255)
+          invalid_placeholder_in_format_string();
+        spec.width = (uint8_t)width;
+        if (i < length && s[i] != '}')
+        {
+          switch (s[i++])
+          {
+          case 'd':
+            spec.type = Type::Decimal;
+            break;
+          case 'x':
+            spec.type = Type::Hex;
+            break;
+          case 'X':
+            spec.type = Type::HexUpper;
+            break;
+          case 'p':
+            spec.type = Type::Pointer;
+            break;
+          case 'c':
+            spec.type = Type::Char;
+            break;
+          case 's':
+            spec.type = Type::String;
+            break;
+          default:
+            invalid_placeholder_in_format_string();
+          }
+        }
+      }
+      if (i >= length)
+        unterminated_placeholder_in_format_string();
+      if (s[i] != '}')
+        invalid_placeholder_in_format_string();
+      i++;
+      parsed.ops[parsed.op_count++] = Op{true, 0, 0, parsed.arg_count++, spec};
+    }
+    else
+    {
+      size_t start = i;
+      while (i < length && s[i] != '{' && s[i] != '}')
+      {
+        i++;
+      }
+      parsed.ops[parsed.op_count++] = Op{false, start, i - start, 0, Spec{}};
+    }
+  }
+
+  return parsed;
+}
+
+template <typename T>
+struct RemoveCV
+{
+  using type = T;
+};
+template <typename T>
+struct RemoveCV<const T>
+{
+  using type = T;
+};
+template <typename T>
+struct RemoveCV<volatile T>
+{
+  using type = T;
+};
+template <typename T>
+struct RemoveCV<const volatile T>
+{
+  using type = T;
+};
+
+template <typename T>
+inline constexpr bool is_pointer = false;
+template <typename T>
+inline constexpr bool is_pointer<T *> = true;
+
+template <typename T>
+inline constexpr bool is_char_array = false;
+template <size_t N>
+inline constexpr bool is_char_array<char[N]> = true;
+
+template <typename T, typename U>
+inline constexpr bool is_same = false;
+template <typename T>
+inline constexpr bool is_same<T, T> = true;
+
+enum class Category
+{
+  Unsupported,
+  Bool,
+  Char,
+  Signed,
+  Unsigned,
+  Pointer,
+  String
+};
+
+template <typename T>
+consteval Category categorize()
+{
+  using U = typename RemoveCV<T>::type;
+  if constexpr (is_same<U, bool>)
+    return Category::Bool;
+  else if constexpr (is_same<U, char>)
+    return Category::Char;
+  else if constexpr (is_same<U, signed char> || is_same<U, short> || is_same<U, int> ||
+                     is_same<U, long> || is_same<U, long long>)
+    return Category::Signed;
+  else if constexpr (is_same<U, unsigned char> || is_same<U, unsigned short> || is_same<U, unsigned int> ||
+                     is_same<U, unsigned long> || is_same<U, unsigned long long>)
+    return Category::Unsigned;
+  else if constexpr (is_same<U, char *> || is_same<U, const char *> || is_char_array<U>)
+    return Category::String;
+  else if constexpr (is_pointer<U>)
+    return Category::Pointer;
+  else if constexpr (__is_enum(U))
+    return categorize<__underlying_type(U)>();
+  else
+    return Category::Unsupported;
+}
+
+consteval bool accepts(Type type, Category category)
+{
+  bool integer = category == Category::Signed || category == Category::Unsigned;
+  switch (type)
+  {
+  case Type::Default:
+    return category != Category::Unsupported;
+  case Type::Decimal:
+    return integer || category == Category::Char || category == Category::Bool;
+  case Type::Hex:
+  case Type::HexUpper:
+  case Type::Pointer:
+    return integer || category == Category::Pointer || category == Category::String;
+  case Type::Char:
+    return integer || category == Category::Char;
+  case Type::String:
+    return category == Category::String;
+  }
+  return false;
+}
+
+class Writer
+{
+public:
+  Writer(printf_callback_t callback, void *ctx) : callback(callback), ctx(ctx) {}
+
+  void write(const char *data, size_t size)
+  {
+    if (length + size > sizeof(buffer))
+    {
+      flush();
+      if (size > sizeof(buffer))
+      {
+        callback(ctx, data, size);
+        count += size;
+        return;
+      }
+    }
+    for (size_t i = 0; i < size; i++)
+    {
+      buffer[length + i] = data[i];
+    }
+    length += size;
+    count += size;
+  }
+
+  void flush()
+  {
+    if (length)
+    {
+      callback(ctx, buffer, length);
+      length = 0;
+    }
+  }
+
+  int get_count() const { return (int)count; }
+
+private:
+  printf_callback_t callback;
+  void *ctx;
+  char buffer[128];
+  size_t length = 0;
+  size_t count = 0;
+};
+
+void write_unsigned(Writer &writer, uint64_t value, Spec spec);
+void write_signed(Writer &writer, int64_t value, Spec spec);
+void write_hex(Writer &writer, uint64_t value, Spec spec);
+void write_pointer(Writer &writer, uint64_t value, Spec spec);
+void write_string(Writer &writer, const char *value, Spec spec);
+void write_char(Writer &writer, char value, Spec spec);
+
+template <Spec S, typename T>
+inline void write_arg(Writer &writer, const T &value)
+{
+  constexpr Category category = categorize<T>();
+  static_assert(category != Category::Unsupported, "kfmt: argument type cannot be formatted");
+  static_assert(accepts(S.type, category), "kfmt: placeholder type does not match argument type");
+
+  if constexpr (S.type == Type::Hex || S.type == Type::HexUpper)
+  {
+    if constexpr (category == Category::Pointer || category == Category::String)
+      write_hex(writer, (uint64_t)(uintptr_t)value, S);
+    else
+      write_hex(writer, (uint64_t)value, S);
+  }
+  else if constexpr (S.type == Type::Pointer ||
+                     (S.type == Type::Default && category == Category::Pointer))
+  {
+    if constexpr (category == Category::Pointer || category == Category::String)
+      write_pointer(writer, (uint64_t)(uintptr_t)value, S);
+    else
+      write_pointer(writer, (uint64_t)value, S);
+  }
+  else if constexpr (S.type == Type::String || category == Category::String)
+  {
+    write_string(writer, value, S);
+  }
+  else if constexpr (S.type == Type::Char || (S.type == Type::Default && category == Category::Char))
+  {
+    write_char(writer, (char)value, S);
+  }
+  else if constexpr (category == Category::Bool && S.type == Type::Default)
+  {
+    write_string(writer, value ? "true" : "false", S);
+  }
+  else if constexpr (category == Category::Signed || category == Category::Char)
+  {
+    write_signed(writer, (int64_t)value, S);
+  }
+  else
+  {
+    write_unsigned(writer, (uint64_t)value, S);
+  }
+}
+
+template <size_t K, typename T, typename... Rest>
+inline const auto &nth(const T &first, const Rest &...rest)
+{
+  if constexpr (K == 0)
+    return first;
+  else
+    return nth<K - 1>(rest...);
+}
+
+template <FixedString Fmt>
+inline constexpr auto parsed_format = parse<Fmt>();
+
+template <FixedString Fmt, size_t I, typename... Args>
+inline void run(Writer &writer, const Args &...args)
+{
+  if constexpr (I < parsed_format<Fmt>.op_count)
+  {
+    constexpr Op op = parsed_format<Fmt>.ops[I];
+    if constexpr (op.is_arg)
+      write_arg<op.spec>(writer, nth<op.arg>(args...));
+    else
+      writer.write(Fmt.data + op.start, op.length);
+    run<Fmt, I + 1>(writer, args...);
+  }
+}
+
+template <FixedString Fmt, typename... Args>
+inline int format_to(printf_callback_t callback, void *ctx, const Args &...args)
+{
+  static_assert(parsed_format<Fmt>.arg_count == sizeof...(Args),
+                "kfmt: number of arguments does not match format string");
+  Writer writer(callback, ctx);
+  run<Fmt, 0>(writer, args...);
+  writer.flush();
+  return writer.get_count();
+}
+
+struct BufferTarget
+{
+  char *buffer;
+  size_t size;
+  size_t length;
+};
+
+void buffer_write(void *ctx, const char *data, size_t size);
+
+template <FixedString Fmt, typename... Args>
+inline int format(char *buffer, size_t size, const Args &...args)
+{
+  BufferTarget target = {buffer, size, 0};
+  int count = format_to<Fmt>(buffer_write, &target, args...);
+  if (size > 0)
+  {
+    buffer[target.length < size ? target.length : size - 1] = '\0';
+  }
+  return count;
+}
+
+template <FixedString Fmt, typename... Args>
+inline int print(const Args &...args)
+{
+  return format_to<Fmt>(console_write, nullptr, args...);
+}
+
+} // namespace kfmt
+
+#endif
@@ -0,0 +1,102 @@
+#ifndef _WHITE_OS_KLOG_H
+#define _WHITE_OS_KLOG_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdio.h>
+
+#include <kernel/kfmt.h>
+
+/*
+ * Deferred binary log. klog<"fmt">(args...) only stores a pointer to its
+ * call site descriptor, a TSC timestamp and the raw argument words into
+ * a per-CPU ring; formatting happens when the ring is drained. The format
+ * string uses kfmt syntax and is type checked at compile time.
+ *
+ * Producers never take a lock: a record is reserved with a single xadd,
+ * which interrupts on the same CPU cannot split, and published by writing
+ * its sequence number last. When a ring wraps the oldest records are
+ * overwritten and counted as lost by the next drain.
+ *
+ * Arguments are captured by value, so %s-style string arguments must
+ * still be valid when the log is drained; string literals always are.
+ */
+
+#define KLOG_MAX_CPUS 4
+#define KLOG_RING_RECORDS 1024
+#define KLOG_MAX_ARGS 5
+
+typedef void (*klog_decoder_t)(printf_callback_t callback, void *ctx, const uint64_t *args);
+
+struct klog_site
+{
+  const char *fmt;
+  klog_decoder_t decode;
+};
+
+struct alignas(64) klog_record
+{
+  const klog_site *site;
+  uint64_t timestamp;
+  uint64_t sequence;
+  uint64_t args[KLOG_MAX_ARGS];
+};
+
+void klog_initialize(void);
+void klog_write(const klog_site *site, const uint64_t *args);
+size_t klog_drain(printf_callback_t callback, void *ctx);
+size_t klog_flush(void);
+void klog_discard(void);
+
+namespace klog_detail
+{
+
+template <size_t... I>
+struct Indices
+{
+};
+
+template <typename T>
+inline uint64_t to_raw(T value)
+{
+  if constexpr (kfmt::is_pointer<T>)
+    return (uint64_t)(uintptr_t)value;
+  else
+    return (uint64_t)value;
+}
+
+template <typename T>
+inline T from_raw(uint64_t raw)
+{
+  if constexpr (kfmt::is_pointer<T>)
+    return (T)(uintptr_t)raw;
+  else
+    return (T)raw;
+}
+
+template <kfmt::FixedString Fmt, typename... Args, size_t... I>
+inline void decode(Indices<I...>, printf_callback_t callback, void *ctx, const uint64_t *args)
+{
+  kfmt::format_to<Fmt>(callback, ctx, from_raw<Args>(args[I])...);
+}
+
+template <kfmt::FixedString Fmt, typename... Args>
+void decode(printf_callback_t callback, void *ctx, const uint64_t *args)
+{
+  decode<Fmt, Args...>(Indices<__integer_pack(sizeof...(Args))...>{}, callback, ctx, args);
+}
+
+template <kfmt::FixedString Fmt, typename... Args>
+inline constexpr klog_site site = {Fmt.data, decode<Fmt, Args...>};
+
+} // namespace klog_detail
+
+template <kfmt::FixedString Fmt, typename... Args>
+inline void klog(Args... args)
+{
+  static_assert(sizeof...(Args) <= KLOG_MAX_ARGS, "klog: too many arguments");
+  uint64_t raw[KLOG_MAX_ARGS > 0 ? KLOG_MAX_ARGS : 1] = {klog_detail::to_raw(args)...};
+  klog_write(&klog_detail::site<Fmt, Args...>, raw);
+}
+
+#endif
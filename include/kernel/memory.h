@@ -4,9 +4,15 @@
 #include <stdint.h>
 #include <stddef.h>
 
+#include "slab.h"
+
 #define PAGE_SIZE 4096
 #define PMM_BLOCK_SIZE PAGE_SIZE
 
+#define VMALLOC_START 0xFFFFC90000000000
+#define VMALLOC_END 0xFFFFE90000000000
+#define TLB_FLUSH_ALL_THRESHOLD 32
+
 #define PTE_FRAME_MASK 0x000FFFFFFFFFF000
 #define PTE_FLAGS_MASK 0xFFF
 
@@ -27,6 +33,7 @@ public:
   void initialize();
   uint64_t alloc();
   uint64_t allocBlocks(size_t);
+  uint64_t allocBlocksAligned(size_t, size_t);
   void free(void *);
   void freeBlocks(void *, size_t);
   size_t getUsableMemory();
@@ -95,6 +102,11 @@ struct PageTable
       entries[i].value = 0;
     }
   }
+
+  static void construct(PageTable *table)
+  {
+    table->clear();
+  }
 };
 class VirtualMemoryManager
 {
@@ -105,13 +117,25 @@ public:
 
   void map_page(uint64_t virtual_addr, uint64_t physical_addr, uint64_t flags);
   void unmap_page(uint64_t virtual_addr);
+  void unmap_range(uint64_t virtual_addr, size_t pages);
   uint64_t get_physical_address(uint64_t virtual_addr);
 
   void *kmalloc(size_t size);
+  void *kmalloc_aligned(size_t size, size_t align);
+  void *krealloc(void *ptr, size_t size);
+  size_t kmalloc_usable_size(void *ptr);
   void kfree(void *ptr);
 
+  void *vmalloc(size_t size);
+  void vfree(void *ptr);
+
+  void *ioremap(uint64_t physical_addr, size_t size, uint64_t flags);
+  void iounmap(void *ptr);
+
   bool is_mapped(uint64_t virtual_addr);
   void invalidate_tlb(uint64_t virtual_addr);
+  void invalidate_tlb_range(uint64_t virtual_addr, size_t pages);
+  void flush_tlb();
 
   void print_memory_map();
   void print_page_tables();
@@ -120,6 +144,7 @@ public:
 
   void *physicalToVirtual(uint64_t physical_addr);
   uint64_t virtualToPhysical(void *virtual_addr);
+  uint64_t get_hhdm_offset();
 
 private:
   VirtualMemoryManager() = default;
@@ -128,7 +153,8 @@ private:
   VirtualMemoryManager(const VirtualMemoryManager &) = delete;
   VirtualMemoryManager &operator=(const VirtualMemoryManager &) = delete;
 
-  PageTable *pml4_table;
+  PageTable *pml4_table = nullptr;
+  ObjectCache<PageTable> pageTableCache{"page_table", PageTable::construct, PAGE_SIZE};
 
   struct HeapBlock
   {
@@ -138,19 +164,115 @@ private:
     HeapBlock *prev;
   };
 
-  HeapBlock *heap_start;
-  uint64_t heap_current;
-  uint64_t heap_end;
+  struct VmArea
+  {
+    uint64_t start;
+    size_t pages;
+    bool io;
+    VmArea *next;
+  };
+
+  VmArea *vmalloc_areas = nullptr;
+  ObjectCache<VmArea> vmAreaCache{"vm_area"};
+
+  HeapBlock *heap_start = nullptr;
+  uint64_t heap_current = 0;
+  uint64_t heap_end = 0;
 
   PageTable *get_or_create_table(PageTableEntry *entry, uint64_t flags);
+  PageTable *get_table(PageTableEntry *entry);
+  bool clear_page(uint64_t virtual_addr, bool release = true);
+  VmArea **find_vm_gap(size_t pages, uint64_t *start);
+  VmArea **find_vm_area(uint64_t start);
   void initialize_kernel_mappings();
   void initialize_heap();
   HeapBlock *find_free_block(size_t size);
+  void *allocate_block(size_t size);
+  void release_block(void *ptr);
+  void split_block(HeapBlock *block, size_t size);
   void merge_free_blocks();
 
   PageTable *clonePageTable(PageTable *table);
   void copyTable(PageTable *dst, PageTable *src);
-  void copyPageTable(PageTable *src, PageTable *dst, int level);
+  bool copyPageTable(PageTable *src, PageTable *dst, int level);
+};
+
+struct ArenaChunk
+{
+  ArenaChunk *next;
+  size_t pages;
+};
+
+/*
+ * Bump-pointer allocator over a chain of page-sized chunks. Objects are
+ * never freed individually; reset() rewinds the whole arena in O(1) and
+ * keeps its chunks for reuse, release() hands them back to the PMM.
+ */
+class Arena
+{
+public:
+  struct Mark
+  {
+    ArenaChunk *chunk;
+    uint8_t *ptr;
+  };
+
+  constexpr Arena() = default;
+
+  Arena(const Arena &) = delete;
+  Arena &operator=(const Arena &) = delete;
+
+  void *alloc(size_t size, size_t align = 8)
+  {
+    uint8_t *p = (uint8_t *)(((uint64_t)ptr + align - 1) & ~(uint64_t)(align - 1));
+    if (ptr && p + size <= end)
+    {
+      ptr = p + size;
+      return p;
+    }
+    return alloc_slow(size, align);
+  }
+
+  template <typename T>
+  T *alloc(size_t count = 1)
+  {
+    return static_cast<T *>(alloc(sizeof(T) * count, alignof(T)));
+  }
+
+  Mark mark() const { return {current, ptr}; }
+  void rewind(Mark mark);
+  void reset();
+  void release();
+
+  size_t get_chunk_count() const;
+
+private:
+  ArenaChunk *head = nullptr;
+  ArenaChunk *current = nullptr;
+  uint8_t *ptr = nullptr;
+  uint8_t *end = nullptr;
+
+  void *alloc_slow(size_t size, size_t align);
+  void use_chunk(ArenaChunk *chunk);
+};
+
+class ScopedArena
+{
+public:
+  explicit ScopedArena(Arena &arena) : arena(arena), saved(arena.mark()) {}
+  ~ScopedArena() { arena.rewind(saved); }
+
+  ScopedArena(const ScopedArena &) = delete;
+  ScopedArena &operator=(const ScopedArena &) = delete;
+
+  void *alloc(size_t size, size_t align = 8) { return arena.alloc(size, align); }
+
+  template <typename T>
+  T *alloc(size_t count = 1) { return arena.alloc<T>(count); }
+
+private:
+  Arena &arena;
+  Arena::Mark saved;
 };
 
 inline PhysicalMemoryManager *pmm()
@@ -0,0 +1,48 @@
+#ifndef _WHITE_OS_PCI_H
+#define _WHITE_OS_PCI_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+#define PCI_CONFIG_ADDRESS 0xCF8
+#define PCI_CONFIG_DATA 0xCFC
+
+#define PCI_VENDOR_ID 0x00
+#define PCI_DEVICE_ID 0x02
+#define PCI_COMMAND 0x04
+#define PCI_HEADER_TYPE 0x0E
+#define PCI_BAR0 0x10
+
+#define PCI_COMMAND_IO (1u << 0)
+#define PCI_COMMAND_MEMORY (1u << 1)
+#define PCI_COMMAND_MASTER (1u << 2)
+
+#define PCI_BAR_IO 0x1
+#define PCI_BAR_IO_MASK 0xFFFFFFFC
+
+/* A function found through configuration mechanism #1. */
+typedef struct pci_device {
+    uint8_t bus;
+    uint8_t slot;
+    uint8_t function;
+    uint16_t vendor_id;
+    uint16_t device_id;
+} pci_device;
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+uint32_t pci_read32(const pci_device *dev, uint8_t offset);
+uint16_t pci_read16(const pci_device *dev, uint8_t offset);
+void pci_write32(const pci_device *dev, uint8_t offset, uint32_t value);
+void pci_write16(const pci_device *dev, uint8_t offset, uint16_t value);
+
+int pci_find_device(uint16_t vendor_id, uint16_t device_id, pci_device *out);
+void pci_enable(const pci_device *dev, uint16_t command);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
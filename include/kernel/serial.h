@@ -2,17 +2,59 @@
 #define _WHITE_OS_SERIAL_H
 
 #include <stdint.h>
+#include <stddef.h>
+#include <stdarg.h>
 
 #define COM1 0x3F8
+#define SERIAL_FIFO_SIZE 16
+#define SERIAL_WRITER_SIZE 256
+
+/*
+ * The UART divides SERIAL_BASE_BAUD (its 1.8432 MHz clock / 16) by the
+ * divisor latch. Boards and emulators with a faster clock can report it
+ * through serial_set_base_baud to reach higher rates.
+ */
+#define SERIAL_BASE_BAUD 115200
+#define SERIAL_DEFAULT_BAUD 115200
+
+/*
+ * Once serial_enable_interrupts has been called, writes only copy into
+ * the transmit ring and the THRE interrupt refills the FIFO from it;
+ * received bytes are collected into the receive ring by the RX and RX
+ * timeout interrupts. A writer finding the transmit ring full feeds the
+ * UART itself until there is room again.
+ */
+#define SERIAL_TX_RING_SIZE 4096
+#define SERIAL_RX_RING_SIZE 256
+
+/*
+ * Accumulates output and hands it to the UART in SERIAL_WRITER_SIZE
+ * chunks. serial_writer_write matches printf_callback_t, so a writer can
+ * be passed directly as the sink context of vcbprintf and friends.
+ */
+typedef struct serial_writer {
+    size_t length;
+    char buffer[SERIAL_WRITER_SIZE];
+} serial_writer;
 
 #ifdef __cplusplus
 extern "C" {
 #endif
 
 void serial_initialize(void);
+void serial_enable_interrupts(void);
+void serial_panic_flush(void);
+int serial_set_baud(uint32_t baud);
+void serial_set_base_baud(uint32_t base_baud);
+int serial_received(void);
+char serial_read(void);
 void serial_putchar(char c);
 void serial_write(const char *str);
+void serial_write_buffer(const char *data, size_t size);
 void serial_printf(const char *fmt, ...);
+void serial_vprintf(const char *fmt, va_list args);
+void serial_writer_write(void *ctx, const char *data, size_t size);
+void serial_writer_flush(serial_writer *writer);
 
 #ifdef __cplusplus
 }
@@ -0,0 +1,106 @@
+#ifndef _WHITE_OS_SLAB_H
+#define _WHITE_OS_SLAB_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+#define KMEM_CACHE_LINE_SIZE 64
+#define KMEM_CACHE_NAME_MAX 32
+#define KMEM_CACHE_HASH_SIZE 64
+#define KMEM_CACHE_MAX_FREE_SLABS 2
+
+typedef void (*kmem_ctor_t)(void *);
+
+/*
+ * A slab is a run of 2^order pages carved into equally sized objects.
+ * Small caches keep this header at the start of the slab page; caches
+ * whose objects are too large for that keep it off-slab and find it
+ * again through the cache's hash table.
+ */
+struct kmem_slab
+{
+  struct kmem_cache *cache;
+  kmem_slab *next;
+  kmem_slab *prev;
+  kmem_slab *hash_next;
+  uint8_t *base;
+  uint8_t *objects;
+  size_t inuse;
+  uint16_t *freelist;
+};
+
+struct kmem_cache
+{
+  char name[KMEM_CACHE_NAME_MAX];
+  size_t object_size;
+  size_t align;
+  size_t stride;
+  size_t order;
+  size_t objects_per_slab;
+  bool off_slab;
+  kmem_ctor_t ctor;
+
+  size_t color_next;
+  size_t color_max;
+
+  kmem_slab *full;
+  kmem_slab *partial;
+  kmem_slab *free;
+  size_t free_slabs;
+
+  size_t total_slabs;
+  size_t active_objects;
+
+  kmem_slab *hash[KMEM_CACHE_HASH_SIZE];
+};
+
+kmem_cache *kmem_cache_create(const char *name, size_t size, size_t align, kmem_ctor_t ctor);
+void kmem_cache_destroy(kmem_cache *cache);
+void *kmem_cache_alloc(kmem_cache *cache);
+void kmem_cache_free(kmem_cache *cache, void *obj);
+size_t kmem_cache_shrink(kmem_cache *cache);
+void kmem_cache_print_stats(kmem_cache *cache);
+
+/*
+ * Typed front end for a kmem_cache. The underlying cache is created on
+ * first use, so an ObjectCache can live in static storage without a
+ * global constructor. Objects handed back through free() must be in
+ * their constructed state; the constructor only runs when a slab is
+ * populated.
+ */
+template <typename T>
+class ObjectCache
+{
+public:
+  constexpr ObjectCache(const char *name, void (*ctor)(T *) = nullptr, size_t align = alignof(T))
+      : name(name), ctor(ctor), align(align) {}
+
+  T *alloc()
+  {
+    if (!cache && !create())
+      return nullptr;
+    return static_cast<T *>(kmem_cache_alloc(cache));
+  }
+
+  void free(T *obj)
+  {
+    if (obj)
+      kmem_cache_free(cache, obj);
+  }
+
+  kmem_cache *get() { return cache; }
+
+private:
+  const char *name;
+  void (*ctor)(T *);
+  size_t align;
+  kmem_cache *cache = nullptr;
+
+  bool create()
+  {
+    cache = kmem_cache_create(name, sizeof(T), align, reinterpret_cast<kmem_ctor_t>(ctor));
+    return cache != nullptr;
+  }
+};
+
+#endif
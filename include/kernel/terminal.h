@@ -9,12 +9,44 @@
 extern "C" {
 #endif
 
+/*
+ * Character cells kept for the visible screen and for the ring of rows
+ * that also provides scrollback. With 8x16 glyphs the history covers a
+ * little over 500 rows at 1920x1080.
+ */
+#define TERMINAL_SCREEN_CELLS (64 * 1024)
+#define TERMINAL_HISTORY_CELLS (128 * 1024)
+#define TERMINAL_MAX_ROWS 512
+
+/*
+ * When the back buffer is enabled, output is drawn into RAM and copied to
+ * the framebuffer by terminal_flush. The policy decides when that happens
+ * on its own: after every write, after writes containing a newline, or
+ * only when terminal_flush is called.
+ */
+typedef enum terminal_flush_policy {
+    TERMINAL_FLUSH_IMMEDIATE,
+    TERMINAL_FLUSH_NEWLINE,
+    TERMINAL_FLUSH_BATCHED
+} terminal_flush_policy;
+
 volatile struct limine_framebuffer_request* get_framebuffer_request();
 
 void terminal_initialize(void);
 void terminal_clear(void);
 void terminal_set_color(uint32_t foreground, uint32_t background);
 
+int terminal_enable_back_buffer(void);
+void terminal_set_flush_policy(terminal_flush_policy policy);
+void terminal_flush(void);
+void terminal_scrollback(size_t lines);
+
+/*
+ * Output understands the common VT100/ANSI escape sequences: SGR colors
+ * (8/16, 256 and 24-bit), cursor movement and positioning, erase in
+ * line and display, insert/delete line and scroll regions (DECSTBM).
+ * terminal_set_color sets the colors that SGR 0 returns to.
+ */
 void terminal_putchar(char c);
 void terminal_write(const char* data, size_t size);
 void terminal_writestring(const char* data);
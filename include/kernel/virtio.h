@@ -0,0 +1,87 @@
+#ifndef _WHITE_OS_VIRTIO_H
+#define _WHITE_OS_VIRTIO_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+/*
+ * Legacy (virtio 0.9.5) PCI transport: registers live in I/O BAR 0 and
+ * each virtqueue is one physically contiguous block whose page number is
+ * written to VIRTIO_PCI_QUEUE_PFN.
+ */
+#define VIRTIO_VENDOR_ID 0x1AF4
+#define VIRTIO_CONSOLE_DEVICE_ID 0x1003
+
+#define VIRTIO_PCI_HOST_FEATURES 0x00
+#define VIRTIO_PCI_GUEST_FEATURES 0x04
+#define VIRTIO_PCI_QUEUE_PFN 0x08
+#define VIRTIO_PCI_QUEUE_SIZE 0x0C
+#define VIRTIO_PCI_QUEUE_SELECT 0x0E
+#define VIRTIO_PCI_QUEUE_NOTIFY 0x10
+#define VIRTIO_PCI_STATUS 0x12
+#define VIRTIO_PCI_ISR 0x13
+
+#define VIRTIO_STATUS_ACKNOWLEDGE 0x01
+#define VIRTIO_STATUS_DRIVER 0x02
+#define VIRTIO_STATUS_DRIVER_OK 0x04
+#define VIRTIO_STATUS_FAILED 0x80
+
+#define VIRTIO_PCI_VRING_ALIGN 4096
+
+#define VRING_DESC_F_NEXT 1
+#define VRING_DESC_F_WRITE 2
+#define VRING_USED_F_NO_NOTIFY 1
+
+#define VIRTIO_CONSOLE_RX_QUEUE 0
+#define VIRTIO_CONSOLE_TX_QUEUE 1
+
+/*
+ * Transmit staging buffer and the largest piece of it one descriptor
+ * covers. A write is cut into chunks that are all made available before
+ * the device is notified once.
+ */
+#define VIRTIO_CONSOLE_BUFFER_SIZE (64 * 1024)
+#define VIRTIO_CONSOLE_CHUNK_SIZE 4096
+
+struct vring_desc {
+    uint64_t addr;
+    uint32_t len;
+    uint16_t flags;
+    uint16_t next;
+};
+
+struct vring_avail {
+    uint16_t flags;
+    uint16_t idx;
+    uint16_t ring[];
+};
+
+struct vring_used_elem {
+    uint32_t id;
+    uint32_t len;
+};
+
+struct vring_used {
+    uint16_t flags;
+    uint16_t idx;
+    struct vring_used_elem ring[];
+};
+
+static inline size_t vring_size(size_t num) {
+    size_t driver = sizeof(struct vring_desc) * num + sizeof(uint16_t) * (3 + num);
+    size_t device = sizeof(uint16_t) * 3 + sizeof(struct vring_used_elem) * num;
+    return ((driver + VIRTIO_PCI_VRING_ALIGN - 1) & ~(size_t)(VIRTIO_PCI_VRING_ALIGN - 1)) + device;
+}
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+int virtio_console_initialize(void);
+void virtio_console_write(const char *data, size_t size);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
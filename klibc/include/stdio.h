@@ -9,9 +9,17 @@
 extern "C" {
 #endif 
 
+typedef void (*printf_callback_t)(void *ctx, const char *data, size_t size);
+
+void console_write(void *ctx, const char *data, size_t size);
+
 void putchar(char c);
 void puts(const char *str);
 
+int vcbprintf(printf_callback_t callback, void *ctx, const char *fmt, va_list args);
+int cbprintf(printf_callback_t callback, void *ctx, const char *fmt, ...);
+int vsnprintf(char *str, size_t size, const char *fmt, va_list args);
+int snprintf(char *str, size_t size, const char *fmt, ...);
 int vsprintf(char *str, const char *fmt, va_list args);
 int sprintf(char *str, const char *fmt, ...);
 int printf(const char *fmt, ...);
@@ -8,10 +8,25 @@ extern "C" {
 #endif 
 
 size_t strlen(const char *str);
+size_t strnlen(const char *str, size_t max);
+int strcmp(const char *str1, const char *str2);
+int strncmp(const char *str1, const char *str2, size_t num);
+void *memchr(const void *ptr, int value, size_t num);
+void *memrchr(const void *ptr, int value, size_t num);
+int memcmp(const void *ptr1, const void *ptr2, size_t num);
 void *memset(void *ptr, int value, size_t num);
 void *memcpy(void *dest, const void *src, size_t num);
+void *memmove(void *dest, const void *src, size_t num);
+
+#define MEM_NT_THRESHOLD (256 * 1024)
+
+void *memcpy_nt(void *dest, const void *src, size_t num);
+void *memset_nt(void *ptr, int value, size_t num);
 char *strcpy(char *dest, const char *src);
 
+void string_initialize(void);
+const char *string_implementation(void);
+
 #ifdef __cplusplus
 }
 #endif
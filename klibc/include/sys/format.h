@@ -0,0 +1,26 @@
+#ifndef _SYS_FORMAT_H
+#define _SYS_FORMAT_H
+
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * Integer conversions shared by the printf family and kfmt. They fill
+ * the buffer backwards from end and return the first digit; the caller
+ * provides room for at least 20 decimal or 16 hex digits.
+ */
+
+extern const char __hex_lower[];
+extern const char __hex_upper[];
+
+char *__format_decimal(char *end, uint64_t value);
+char *__format_hex(char *end, uint64_t value, const char *digits);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
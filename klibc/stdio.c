@@ -1,407 +1,480 @@
 #include <stdio.h>
-#include <kernel/serial.h>
-#include <kernel/terminal.h>
+#include <string.h>
+#include <kernel/console.h>
 #include <stdarg.h>
+#include <sys/format.h>
 
-void putchar(char c)
+struct format_sink
+{
+    printf_callback_t write;
+    void *ctx;
+    int count;
+};
+
+struct buffer_sink
+{
+    char *buffer;
+    size_t size;
+    size_t length;
+};
+
+static void sink_write(struct format_sink *sink, const char *data, size_t length)
 {
-    serial_putchar(c);
-    terminal_putchar(c);
+    if (length == 0)
+        return;
+    sink->write(sink->ctx, data, length);
+    sink->count += length;
 }
 
-void puts(const char *str)
+void console_write(void *ctx, const char *data, size_t length)
 {
-    while (*str)
-    {
-        putchar(*str++);
-    }
-    putchar('\n');
+    (void)ctx;
+    console_queue_write(data, length);
 }
 
-static void reverse_string(char *str, size_t length)
+static void buffer_write(void *ctx, const char *data, size_t length)
 {
-    size_t start = 0;
-    size_t end = length - 1;
-    while (start < end)
+    struct buffer_sink *sink = (struct buffer_sink *)ctx;
+    if (sink->length + 1 < sink->size)
     {
-        char temp = str[start];
-        str[start] = str[end];
-        str[end] = temp;
-        start++;
-        end--;
+        size_t room = sink->size - 1 - sink->length;
+        memcpy(sink->buffer + sink->length, data, length < room ? length : room);
     }
+    sink->length += length;
 }
 
-static size_t uint_to_string(unsigned int num, char *str, int base)
+void putchar(char c)
 {
-    size_t i = 0;
+    console_queue_write(&c, 1);
+}
 
-    if (num == 0)
-    {
-        str[i++] = '0';
-        str[i] = '\0';
-        return i;
-    }
+void puts(const char *str)
+{
+    console_write(NULL, str, strlen(str));
+    console_write(NULL, "\n", 1);
+}
 
-    const char *digits = "0123456789ABCDEF";
+#define FLAG_LEFT 0x01
+#define FLAG_PLUS 0x02
+#define FLAG_SPACE 0x04
+#define FLAG_ALT 0x08
+#define FLAG_ZERO 0x10
 
-    while (num != 0)
+enum length_modifier
+{
+    LENGTH_NONE,
+    LENGTH_HH,
+    LENGTH_H,
+    LENGTH_L,
+    LENGTH_LL,
+    LENGTH_Z,
+    LENGTH_J,
+    LENGTH_T
+};
+
+struct format_spec
+{
+    int flags;
+    int width;
+    int precision;
+    enum length_modifier length;
+};
+
+static const char digit_pairs[201] =
+    "00010203040506070809"
+    "10111213141516171819"
+    "20212223242526272829"
+    "30313233343536373839"
+    "40414243444546474849"
+    "50515253545556575859"
+    "60616263646566676869"
+    "70717273747576777879"
+    "80818283848586878889"
+    "90919293949596979899";
+
+const char __hex_lower[] = "0123456789abcdef";
+const char __hex_upper[] = "0123456789ABCDEF";
+static const char pad_spaces[] = "                ";
+static const char pad_zeros[] = "0000000000000000";
+
+/*
+ * Number conversions fill their buffer backwards from the end, so the
+ * digits come out in order without a reversal pass.
+ */
+char *__format_decimal(char *end, uint64_t value)
+{
+    while (value >= 100)
     {
-        unsigned int rem = num % base;
-        str[i++] = digits[rem];
-        num = num / base;
+        const char *pair = &digit_pairs[(value % 100) * 2];
+        value /= 100;
+        end -= 2;
+        end[0] = pair[0];
+        end[1] = pair[1];
     }
-
-    str[i] = '\0';
-    reverse_string(str, i);
-    return i;
+    if (value >= 10)
+    {
+        const char *pair = &digit_pairs[value * 2];
+        end -= 2;
+        end[0] = pair[0];
+        end[1] = pair[1];
+    }
+    else
+    {
+        *--end = (char)('0' + value);
+    }
+    return end;
 }
 
-static size_t uint64_to_string(uint64_t num, char *str, int base)
+char *__format_hex(char *end, uint64_t value, const char *digits)
 {
-    size_t i = 0;
-
-    if (num == 0)
+    do
     {
-        str[i++] = '0';
-        str[i] = '\0';
-        return i;
-    }
+        *--end = digits[value & 0xF];
+        value >>= 4;
+    } while (value);
+    return end;
+}
 
-    const char *digits = "0123456789ABCDEF";
+static char *format_octal(char *end, uint64_t value)
+{
+    do
+    {
+        *--end = (char)('0' + (value & 7));
+        value >>= 3;
+    } while (value);
+    return end;
+}
 
-    while (num != 0)
+static void sink_pad(struct format_sink *sink, const char *pad, int count)
+{
+    while (count > 0)
     {
-        uint64_t rem = num % base;
-        str[i++] = digits[rem];
-        num = num / base;
+        int chunk = count < 16 ? count : 16;
+        sink_write(sink, pad, chunk);
+        count -= chunk;
     }
+}
 
-    str[i] = '\0';
-    reverse_string(str, i);
-    return i;
+static void emit_padded(struct format_sink *sink, const struct format_spec *spec,
+                        const char *data, int length)
+{
+    int padding = spec->width - length;
+    if (!(spec->flags & FLAG_LEFT))
+        sink_pad(sink, pad_spaces, padding);
+    sink_write(sink, data, length);
+    if (spec->flags & FLAG_LEFT)
+        sink_pad(sink, pad_spaces, padding);
 }
 
-static size_t int_to_string(int num, char *str, int base)
+static void emit_integer(struct format_sink *sink, const struct format_spec *spec,
+                         const char *prefix, int prefix_length,
+                         const char *digits, int digit_count)
 {
-    size_t i = 0;
+    int zeros = spec->precision > digit_count ? spec->precision - digit_count : 0;
+    int padding = spec->width - prefix_length - zeros - digit_count;
 
-    if (num == 0)
+    if (spec->flags & FLAG_LEFT)
     {
-        str[i++] = '0';
-        str[i] = '\0';
-        return i;
+        sink_write(sink, prefix, prefix_length);
+        sink_pad(sink, pad_zeros, zeros);
+        sink_write(sink, digits, digit_count);
+        sink_pad(sink, pad_spaces, padding);
     }
-
-    int is_negative = 0;
-    if (num < 0 && base == 10)
+    else if ((spec->flags & FLAG_ZERO) && spec->precision < 0)
     {
-        is_negative = 1;
-        num = -num;
+        sink_write(sink, prefix, prefix_length);
+        sink_pad(sink, pad_zeros, padding);
+        sink_write(sink, digits, digit_count);
     }
-
-    const char *digits = "0123456789ABCDEF";
-
-    while (num != 0)
+    else
     {
-        int rem = num % base;
-        str[i++] = digits[rem];
-        num = num / base;
+        sink_pad(sink, pad_spaces, padding);
+        sink_write(sink, prefix, prefix_length);
+        sink_pad(sink, pad_zeros, zeros);
+        sink_write(sink, digits, digit_count);
     }
+}
 
-    if (is_negative)
+static int64_t fetch_signed(va_list *args, enum length_modifier length)
+{
+    switch (length)
     {
-        str[i++] = '-';
+    case LENGTH_HH:
+        return (signed char)va_arg(*args, int);
+    case LENGTH_H:
+        return (short)va_arg(*args, int);
+    case LENGTH_L:
+    case LENGTH_Z:
+    case LENGTH_T:
+        return va_arg(*args, long);
+    case LENGTH_LL:
+    case LENGTH_J:
+        return va_arg(*args, long long);
+    default:
+        return va_arg(*args, int);
     }
+}
 
-    str[i] = '\0';
-    reverse_string(str, i);
-    return i;
+static uint64_t fetch_unsigned(va_list *args, enum length_modifier length)
+{
+    switch (length)
+    {
+    case LENGTH_HH:
+        return (unsigned char)va_arg(*args, unsigned int);
+    case LENGTH_H:
+        return (unsigned short)va_arg(*args, unsigned int);
+    case LENGTH_L:
+    case LENGTH_Z:
+    case LENGTH_T:
+        return va_arg(*args, unsigned long);
+    case LENGTH_LL:
+    case LENGTH_J:
+        return va_arg(*args, unsigned long long);
+    default:
+        return va_arg(*args, unsigned int);
+    }
 }
 
-static size_t int64_to_string(int64_t num, char *str, int base)
+static const char *parse_spec(const char *fmt, struct format_spec *spec, va_list *args)
 {
-    size_t i = 0;
+    spec->flags = 0;
+    spec->width = 0;
+    spec->precision = -1;
+    spec->length = LENGTH_NONE;
 
-    if (num == 0)
+    for (;; fmt++)
     {
-        str[i++] = '0';
-        str[i] = '\0';
-        return i;
+        if (*fmt == '-')
+            spec->flags |= FLAG_LEFT;
+        else if (*fmt == '+')
+            spec->flags |= FLAG_PLUS;
+        else if (*fmt == ' ')
+            spec->flags |= FLAG_SPACE;
+        else if (*fmt == '#')
+            spec->flags |= FLAG_ALT;
+        else if (*fmt == '0')
+            spec->flags |= FLAG_ZERO;
+        else
+            break;
     }
 
-    int is_negative = 0;
-    if (num < 0 && base == 10)
+    if (*fmt == '*')
     {
-        is_negative = 1;
-        num = -num;
+        spec->width = va_arg(*args, int);
+        if (spec->width < 0)
+        {
+            spec->flags |= FLAG_LEFT;
+            spec->width = -spec->width;
+        }
+        fmt++;
+    }
+    else
+    {
+        while (*fmt >= '0' && *fmt <= '9')
+        {
+            spec->width = spec->width * 10 + (*fmt++ - '0');
+        }
     }
 
-    const char *digits = "0123456789ABCDEF";
-
-    while (num != 0)
+    if (*fmt == '.')
     {
-        int64_t rem = num % base;
-        str[i++] = digits[rem];
-        num = num / base;
+        fmt++;
+        spec->precision = 0;
+        if (*fmt == '*')
+        {
+            spec->precision = va_arg(*args, int);
+            fmt++;
+        }
+        else
+        {
+            while (*fmt >= '0' && *fmt <= '9')
+            {
+                spec->precision = spec->precision * 10 + (*fmt++ - '0');
+            }
+        }
     }
 
-    if (is_negative)
+    switch (*fmt)
     {
-        str[i++] = '-';
+    case 'h':
+        fmt++;
+        spec->length = LENGTH_H;
+        if (*fmt == 'h')
+        {
+            fmt++;
+            spec->length = LENGTH_HH;
+        }
+        break;
+    case 'l':
+        fmt++;
+        spec->length = LENGTH_L;
+        if (*fmt == 'l')
+        {
+            fmt++;
+            spec->length = LENGTH_LL;
+        }
+        break;
+    case 'z':
+        fmt++;
+        spec->length = LENGTH_Z;
+        break;
+    case 'j':
+        fmt++;
+        spec->length = LENGTH_J;
+        break;
+    case 't':
+        fmt++;
+        spec->length = LENGTH_T;
+        break;
     }
 
-    str[i] = '\0';
-    reverse_string(str, i);
-    return i;
+    return fmt;
 }
 
-int vsprintf(char *str, const char *fmt, va_list args)
+int vcbprintf(printf_callback_t callback, void *ctx, const char *fmt, va_list args)
 {
-    char *ptr = str;
-    char num_buf[32];
+    struct format_sink sink = {callback, ctx, 0};
+    struct format_spec spec;
+    char num_buf[24];
+    char *end = num_buf + sizeof(num_buf);
+    va_list ap;
+    va_copy(ap, args);
 
     while (*fmt)
     {
-        if (*fmt == '%')
+        if (*fmt != '%')
         {
-            fmt++;
-            switch (*fmt)
-            {
-            case 'c':
-            {
-                char c = (char)va_arg(args, int);
-                *ptr++ = c;
-                break;
-            }
-            case 's':
-            {
-                char *s = va_arg(args, char *);
-                if (!s)
-                    s = "(null)";
-                while (*s)
-                {
-                    *ptr++ = *s++;
-                }
-                break;
-            }
-            case 'd':
-            {
-                if (*(fmt + 1) == 'l')
-                {
-                    fmt++;
-                    if (*(fmt + 1) == 'l')
-                    {
-                        fmt++;
-                        int64_t num = va_arg(args, int64_t);
-                        size_t len = int64_to_string(num, num_buf, 10);
-                        for (size_t i = 0; i < len; i++)
-                        {
-                            *ptr++ = num_buf[i];
-                        }
-                    }
-                    else
-                    {
-                        long num = va_arg(args, long);
-                        size_t len = int_to_string(num, num_buf, 10);
-                        for (size_t i = 0; i < len; i++)
-                        {
-                            *ptr++ = num_buf[i];
-                        }
-                    }
-                }
-                else
-                {
-                    int num = va_arg(args, int);
-                    size_t len = int_to_string(num, num_buf, 10);
-                    for (size_t i = 0; i < len; i++)
-                    {
-                        *ptr++ = num_buf[i];
-                    }
-                }
-                break;
-            }
-            case 'x':
-            {
-                if (*(fmt + 1) == 'l')
-                {
-                    fmt++;
-                    if (*(fmt + 1) == 'l')
-                    {
-                        fmt++;
-                        uint64_t num = va_arg(args, uint64_t);
-                        size_t len = uint64_to_string(num, num_buf, 16);
-                        for (size_t i = 0; i < len; i++)
-                        {
-                            *ptr++ = num_buf[i];
-                        }
-                    }
-                    else
-                    {
-                        unsigned long num = va_arg(args, unsigned long);
-                        size_t len = uint_to_string(num, num_buf, 16);
-                        for (size_t i = 0; i < len; i++)
-                        {
-                            *ptr++ = num_buf[i];
-                        }
-                    }
-                }
-                else
-                {
-                    unsigned int num = va_arg(args, unsigned int);
-                    size_t len = uint_to_string(num, num_buf, 16);
-                    for (size_t i = 0; i < len; i++)
-                    {
-                        *ptr++ = num_buf[i];
-                    }
-                }
-                break;
-            }
-            case 'p':
-            {
-                void *p = va_arg(args, void *);
-                *ptr++ = '0';
-                *ptr++ = 'x';
-                size_t len = uint64_to_string((uint64_t)p, num_buf, 16);
-                size_t padding = 16 > len ? 16 - len : 0;
-                for (size_t i = 0; i < padding; i++)
-                {
-                    *ptr++ = '0';
-                }
-                for (size_t i = 0; i < len; i++)
-                {
-                    *ptr++ = num_buf[i];
-                }
-                break;
-            }
-            case 'z':
+            const char *run = fmt;
+            while (*fmt && *fmt != '%')
             {
                 fmt++;
-                if (*fmt == 'x')
-                {
-                    size_t num = va_arg(args, size_t);
-                    size_t len = uint64_to_string((uint64_t)num, num_buf, 16);
-                    for (size_t i = 0; i < len; i++)
-                    {
-                        *ptr++ = num_buf[i];
-                    }
-                }
-                else if (*fmt == 'u')
-                {
-                    size_t num = va_arg(args, size_t);
-                    size_t len = uint64_to_string((uint64_t)num, num_buf, 10);
-                    for (size_t i = 0; i < len; i++)
-                    {
-                        *ptr++ = num_buf[i];
-                    }
-                }
-                break;
             }
-            case 'u':
-                if (*(fmt + 1) == 'u')
-                {
-                    fmt++;
-                    size_t num = va_arg(args, size_t);
-                    size_t len = uint64_to_string((uint64_t)num, num_buf, 10);
-                    for (size_t i = 0; i < len; i++)
-                    {
-                        *ptr++ = num_buf[i];
-                    }
-                    break;
-                }
-                if (*(fmt + 1) == 'l')
-                {
-                    fmt++;
-                    if (*(fmt + 1) == 'l')
-                    {
-                        fmt++;
-                        uint64_t num = va_arg(args, uint64_t);
-                        size_t len = uint64_to_string(num, num_buf, 10);
-                        for (size_t i = 0; i < len; i++)
-                        {
-                            *ptr++ = num_buf[i];
-                        }
-                    }
-                    else
-                    {
-                        unsigned long num = va_arg(args, unsigned long);
-                        size_t len = uint_to_string(num, num_buf, 10);
-                        for (size_t i = 0; i < len; i++)
-                        {
-                            *ptr++ = num_buf[i];
-                        }
-                    }
-                }
-                else
-                {
-                    unsigned int num = va_arg(args, unsigned int);
-                    size_t len = uint_to_string(num, num_buf, 10);
-                    for (size_t i = 0; i < len; i++)
-                    {
-                        *ptr++ = num_buf[i];
-                    }
-                }
-                break;
-            case 'l':
-            {
-                fmt++;
-                switch (*fmt)
-                {
-                case 'd':
-                {
-                    long num = va_arg(args, long);
-                    size_t len = int_to_string(num, num_buf, 10);
-                    for (size_t i = 0; i < len; i++)
-                    {
-                        *ptr++ = num_buf[i];
-                    }
-                    break;
-                }
-                case 'u':
-                {
-                    unsigned long num = va_arg(args, unsigned long);
-                    size_t len = uint_to_string(num, num_buf, 10);
-                    for (size_t i = 0; i < len; i++)
-                    {
-                        *ptr++ = num_buf[i];
-                    }
-                    break;
-                }
-                case 'x':
-                {
-                    unsigned long num = va_arg(args, unsigned long);
-                    size_t len = uint_to_string(num, num_buf, 16);
-                    for (size_t i = 0; i < len; i++)
-                    {
-                        *ptr++ = num_buf[i];
-                    }
-                    break;
-                }
-                }
-                break;
-            }
-            case '%':
-            {
-                *ptr++ = '%';
-                break;
-            }
-            default:
+            sink_write(&sink, run, fmt - run);
+            continue;
+        }
+
+        const char *spec_start = fmt++;
+        fmt = parse_spec(fmt, &spec, &ap);
+
+        switch (*fmt)
+        {
+        case 'c':
+        {
+            char c = (char)va_arg(ap, int);
+            emit_padded(&sink, &spec, &c, 1);
+            break;
+        }
+        case 's':
+        {
+            const char *s = va_arg(ap, const char *);
+            if (!s)
+                s = "(null)";
+            size_t length = spec.precision >= 0 ? strnlen(s, spec.precision) : strlen(s);
+            emit_padded(&sink, &spec, s, (int)length);
+            break;
+        }
+        case 'd':
+        case 'i':
+        {
+            int64_t value = fetch_signed(&ap, spec.length);
+            uint64_t magnitude = value < 0 ? -(uint64_t)value : (uint64_t)value;
+            char *start = (magnitude == 0 && spec.precision == 0) ? end : __format_decimal(end, magnitude);
+            const char *sign = value < 0 ? "-" : (spec.flags & FLAG_PLUS) ? "+" : (spec.flags & FLAG_SPACE) ? " " : "";
+            emit_integer(&sink, &spec, sign, *sign ? 1 : 0, start, end - start);
+            break;
+        }
+        case 'u':
+        {
+            uint64_t value = fetch_unsigned(&ap, spec.length);
+            char *start = (value == 0 && spec.precision == 0) ? end : __format_decimal(end, value);
+            emit_integer(&sink, &spec, "", 0, start, end - start);
+            break;
+        }
+        case 'x':
+        case 'X':
+        {
+            uint64_t value = fetch_unsigned(&ap, spec.length);
+            char *start = (value == 0 && spec.precision == 0) ? end : __format_hex(end, value, *fmt == 'x' ? __hex_lower : __hex_upper);
+            int alt = (spec.flags & FLAG_ALT) && value != 0;
+            emit_integer(&sink, &spec, *fmt == 'x' ? "0x" : "0X", alt ? 2 : 0, start, end - start);
+            break;
+        }
+        case 'o':
+        {
+            uint64_t value = fetch_unsigned(&ap, spec.length);
+            char *start = (value == 0 && spec.precision == 0) ? end : format_octal(end, value);
+            if ((spec.flags & FLAG_ALT) && (start == end || *start != '0'))
             {
-                *ptr++ = '%';
-                *ptr++ = *fmt;
-                break;
-            }
+                *--start = '0';
             }
+            emit_integer(&sink, &spec, "", 0, start, end - start);
+            break;
         }
-        else
+        case 'p':
+        {
+            uint64_t value = (uint64_t)va_arg(ap, void *);
+            char *start = __format_hex(end, value, __hex_upper);
+            if (spec.precision < 0)
+                spec.precision = 16;
+            emit_integer(&sink, &spec, "0x", 2, start, end - start);
+            break;
+        }
+        case '%':
+        {
+            sink_write(&sink, "%", 1);
+            break;
+        }
+        case '\0':
         {
-            *ptr++ = *fmt;
+            sink_write(&sink, spec_start, fmt - spec_start);
+            va_end(ap);
+            return sink.count;
+        }
+        default:
+        {
+            sink_write(&sink, spec_start, fmt + 1 - spec_start);
+            break;
+        }
         }
         fmt++;
     }
 
-    *ptr = '\0';
-    return ptr - str;
+    va_end(ap);
+    return sink.count;
+}
+
+int cbprintf(printf_callback_t callback, void *ctx, const char *fmt, ...)
+{
+    va_list args;
+    va_start(args, fmt);
+    int result = vcbprintf(callback, ctx, fmt, args);
+    va_end(args);
+    return result;
+}
+
+int vsnprintf(char *str, size_t size, const char *fmt, va_list args)
+{
+    struct buffer_sink sink = {str, size, 0};
+    int result = vcbprintf(buffer_write, &sink, fmt, args);
+    if (size > 0)
+    {
+        str[sink.length < size ? sink.length : size - 1] = '\0';
+    }
+    return result;
+}
+
+int snprintf(char *str, size_t size, const char *fmt, ...)
+{
+    va_list args;
+    va_start(args, fmt);
+    int result = vsnprintf(str, size, fmt, args);
+    va_end(args);
+    return result;
+}
+
+int vsprintf(char *str, const char *fmt, va_list args)
+{
+    return vsnprintf(str, SIZE_MAX - (uintptr_t)str, fmt, args);
 }
 
 int sprintf(char *str, const char *fmt, ...)
@@ -415,30 +488,14 @@ int sprintf(char *str, const char *fmt, ...)
 
 int printf(const char *fmt, ...)
 {
-    char buffer[512];
     va_list args;
     va_start(args, fmt);
-    int result = vsprintf(buffer, fmt, args);
+    int result = vcbprintf(console_write, NULL, fmt, args);
     va_end(args);
-
-    char *ptr = buffer;
-
-    while (*ptr)
-    {
-        putchar(*ptr++);
-    }
     return result;
 }
 
 int vprintf(const char *fmt, va_list args)
 {
-    char buffer[512];
-    int result = vsprintf(buffer, fmt, args);
-    char *ptr = buffer;
-
-    while (*ptr)
-    {
-        putchar(*ptr++);
-    }
-    return result;
-}
\ No newline at end of file
+    return vcbprintf(console_write, NULL, fmt, args);
+}
@@ -1,9 +1,12 @@
 #include <stdio.h>
 #include <stdlib.h>
 
+#include <kernel/console.h>
+
 __attribute__((__noreturn__))
 void abort(void) {
 	// TODO: Add proper kernel panic.
+	console_panic_flush();
 	printf("kernel: panic: abort()\n");
 	while (1) { }
 	__builtin_unreachable();
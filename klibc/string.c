@@ -1,29 +1,513 @@
 #include <stdint.h>
 #include <stddef.h>
+#include <string.h>
+#include <kernel/cpu.h>
+
+typedef uint64_t __attribute__((__may_alias__, __aligned__(1))) unaligned_u64;
+typedef uint64_t __attribute__((__may_alias__)) aligned_u64;
+
+#define ONES 0x0101010101010101ULL
+#define HIGHS 0x8080808080808080ULL
+#define LOWS 0x7F7F7F7F7F7F7F7FULL
+#define STRING_PAGE_SIZE 4096
+
+/*
+ * has_zero() flags the first zero byte of a word exactly, but may also
+ * flag bytes above it. zero_bytes() is exact for every byte and is used
+ * where the highest match matters.
+ */
+static inline uint64_t has_zero(uint64_t v) {
+    return (v - ONES) & ~v & HIGHS;
+}
+
+static inline uint64_t zero_bytes(uint64_t v) {
+    return ~(((v & LOWS) + LOWS) | v | LOWS);
+}
+
+static inline size_t first_byte(uint64_t mask) {
+    return (size_t)__builtin_ctzll(mask) >> 3;
+}
+
+static inline size_t last_byte(uint64_t mask) {
+    return (size_t)(63 - __builtin_clzll(mask)) >> 3;
+}
+
+/*
+ * An unaligned 8-byte load is safe to issue past the end of a string as
+ * long as it does not cross into the next page, which may be unmapped.
+ */
+static inline int word_fits_in_page(const void *p) {
+    return ((uintptr_t)p & (STRING_PAGE_SIZE - 1)) <= STRING_PAGE_SIZE - 8;
+}
+
+#define ERMS_THRESHOLD 64
+#define SSE2_THRESHOLD 1024
+
+static void *memcpy_words(void *dest, const void *src, size_t num);
+static void *memset_words(void *ptr, int value, size_t num);
+
+static void *(*memcpy_impl)(void *, const void *, size_t) = memcpy_words;
+static void *(*memset_impl)(void *, int, size_t) = memset_words;
+static void *(*memcpy_forward_impl)(void *, const void *, size_t) = memcpy_words;
+static const char *string_impl_name = "words";
 
 size_t strlen(const char *str) {
-    size_t len = 0;
-    while (str[len]) len++;
-    return len;
+    uintptr_t misalign = (uintptr_t)str & 7;
+    const aligned_u64 *w = (const aligned_u64*)(str - misalign);
+    uint64_t v = *w | ((1ULL << (misalign * 8)) - 1);
+    uint64_t zero;
+    while (!(zero = has_zero(v))) {
+        v = *++w;
+    }
+    return (const char*)w + first_byte(zero) - str;
 }
 
-void *memset(void *ptr, int value, size_t num) {
+size_t strnlen(const char *str, size_t max) {
+    if (max == 0) {
+        return 0;
+    }
+    uintptr_t misalign = (uintptr_t)str & 7;
+    const aligned_u64 *w = (const aligned_u64*)(str - misalign);
+    uint64_t v = *w | ((1ULL << (misalign * 8)) - 1);
+    size_t scanned = 8 - misalign;
+    uint64_t zero;
+    while (!(zero = has_zero(v))) {
+        if (scanned >= max) {
+            return max;
+        }
+        v = *++w;
+        scanned += 8;
+    }
+    size_t len = (const char*)w + first_byte(zero) - str;
+    return len < max ? len : max;
+}
+
+void *memchr(const void *ptr, int value, size_t num) {
+    const uint8_t *p = (const uint8_t*)ptr;
+    uint8_t c = (uint8_t)value;
+    while (num && ((uintptr_t)p & 7)) {
+        if (*p == c) {
+            return (void*)p;
+        }
+        p++;
+        num--;
+    }
+    uint64_t pattern = c * ONES;
+    while (num >= 8) {
+        uint64_t zero = has_zero(*(const aligned_u64*)p ^ pattern);
+        if (zero) {
+            return (void*)(p + first_byte(zero));
+        }
+        p += 8;
+        num -= 8;
+    }
+    while (num--) {
+        if (*p == c) {
+            return (void*)p;
+        }
+        p++;
+    }
+    return NULL;
+}
+
+void *memrchr(const void *ptr, int value, size_t num) {
+    const uint8_t *p = (const uint8_t*)ptr + num;
+    uint8_t c = (uint8_t)value;
+    while (num && ((uintptr_t)p & 7)) {
+        p--;
+        num--;
+        if (*p == c) {
+            return (void*)p;
+        }
+    }
+    uint64_t pattern = c * ONES;
+    while (num >= 8) {
+        p -= 8;
+        num -= 8;
+        uint64_t zero = zero_bytes(*(const aligned_u64*)p ^ pattern);
+        if (zero) {
+            return (void*)(p + last_byte(zero));
+        }
+    }
+    while (num--) {
+        p--;
+        if (*p == c) {
+            return (void*)p;
+        }
+    }
+    return NULL;
+}
+
+int memcmp(const void *ptr1, const void *ptr2, size_t num) {
+    const uint8_t *a = (const uint8_t*)ptr1;
+    const uint8_t *b = (const uint8_t*)ptr2;
+    while (num >= 8) {
+        uint64_t diff = *(const unaligned_u64*)a ^ *(const unaligned_u64*)b;
+        if (diff) {
+            size_t i = first_byte(diff);
+            return a[i] - b[i];
+        }
+        a += 8;
+        b += 8;
+        num -= 8;
+    }
+    while (num--) {
+        if (*a != *b) {
+            return *a - *b;
+        }
+        a++;
+        b++;
+    }
+    return 0;
+}
+
+int strncmp(const char *str1, const char *str2, size_t num) {
+    const uint8_t *a = (const uint8_t*)str1;
+    const uint8_t *b = (const uint8_t*)str2;
+    while (num) {
+        if (num >= 8 && word_fits_in_page(a) && word_fits_in_page(b)) {
+            uint64_t va = *(const unaligned_u64*)a;
+            uint64_t vb = *(const unaligned_u64*)b;
+            if (!((va ^ vb) | has_zero(va))) {
+                a += 8;
+                b += 8;
+                num -= 8;
+                continue;
+            }
+        }
+        if (*a != *b || *a == 0) {
+            return *a - *b;
+        }
+        a++;
+        b++;
+        num--;
+    }
+    return 0;
+}
+
+int strcmp(const char *str1, const char *str2) {
+    return strncmp(str1, str2, SIZE_MAX);
+}
+
+static void *memcpy_words(void *dest, const void *src, size_t num) {
+    uint8_t *d = (uint8_t*)dest;
+    const uint8_t *s = (const uint8_t*)src;
+    while (num >= 32) {
+        uint64_t a = ((const unaligned_u64*)s)[0];
+        uint64_t b = ((const unaligned_u64*)s)[1];
+        uint64_t c = ((const unaligned_u64*)s)[2];
+        uint64_t e = ((const unaligned_u64*)s)[3];
+        ((unaligned_u64*)d)[0] = a;
+        ((unaligned_u64*)d)[1] = b;
+        ((unaligned_u64*)d)[2] = c;
+        ((unaligned_u64*)d)[3] = e;
+        d += 32;
+        s += 32;
+        num -= 32;
+    }
+    while (num >= 8) {
+        *(unaligned_u64*)d = *(const unaligned_u64*)s;
+        d += 8;
+        s += 8;
+        num -= 8;
+    }
+    while (num--) {
+        *d++ = *s++;
+    }
+    return dest;
+}
+
+static void *memset_words(void *ptr, int value, size_t num) {
     uint8_t *p = (uint8_t*)ptr;
-    for (size_t i = 0; i < num; i++) {
-        p[i] = (uint8_t)value;
+    uint64_t pattern = (uint8_t)value * 0x0101010101010101ULL;
+    while (num >= 32) {
+        ((unaligned_u64*)p)[0] = pattern;
+        ((unaligned_u64*)p)[1] = pattern;
+        ((unaligned_u64*)p)[2] = pattern;
+        ((unaligned_u64*)p)[3] = pattern;
+        p += 32;
+        num -= 32;
+    }
+    while (num >= 8) {
+        *(unaligned_u64*)p = pattern;
+        p += 8;
+        num -= 8;
+    }
+    while (num--) {
+        *p++ = (uint8_t)value;
     }
     return ptr;
 }
 
-void *memcpy(void *dest, const void *src, size_t num) {
+static void *memcpy_erms(void *dest, const void *src, size_t num) {
+    void *ret = dest;
+    __asm__ __volatile__("rep movsb"
+                         : "+D"(dest), "+S"(src), "+c"(num)
+                         :
+                         : "memory");
+    return ret;
+}
+
+static void *memset_erms(void *ptr, int value, size_t num) {
+    void *ret = ptr;
+    __asm__ __volatile__("rep stosb"
+                         : "+D"(ptr), "+c"(num)
+                         : "a"(value)
+                         : "memory");
+    return ret;
+}
+
+static void *memcpy_erms_small(void *dest, const void *src, size_t num) {
+    if (num < ERMS_THRESHOLD) {
+        return memcpy_words(dest, src, num);
+    }
+    return memcpy_erms(dest, src, num);
+}
+
+static void *memset_erms_small(void *ptr, int value, size_t num) {
+    if (num < ERMS_THRESHOLD) {
+        return memset_words(ptr, value, num);
+    }
+    return memset_erms(ptr, value, num);
+}
+
+/*
+ * The kernel does not own the SSE register file on behalf of whatever
+ * it interrupted, so vector paths save and restore it around the copy.
+ * That only pays off for large buffers, hence SSE2_THRESHOLD.
+ */
+struct fpu_state {
+    uint8_t data[512];
+} __attribute__((__aligned__(16)));
+
+static inline void fpu_save(struct fpu_state *state) {
+    __asm__ __volatile__("fxsave %0" : "=m"(*state));
+}
+
+static inline void fpu_restore(struct fpu_state *state) {
+    __asm__ __volatile__("fxrstor %0" : : "m"(*state));
+}
+
+static void *memcpy_sse2(void *dest, const void *src, size_t num) {
+    if (num < SSE2_THRESHOLD) {
+        return memcpy_words(dest, src, num);
+    }
+
     uint8_t *d = (uint8_t*)dest;
     const uint8_t *s = (const uint8_t*)src;
-    for (size_t i = 0; i < num; i++) {
-        d[i] = s[i];
+
+    size_t head = (16 - ((uintptr_t)d & 15)) & 15;
+    memcpy_words(d, s, head);
+    d += head;
+    s += head;
+    num -= head;
+
+    struct fpu_state state;
+    fpu_save(&state);
+    while (num >= 64) {
+        __asm__ __volatile__("movdqu 0(%1), %%xmm0\n\t"
+                             "movdqu 16(%1), %%xmm1\n\t"
+                             "movdqu 32(%1), %%xmm2\n\t"
+                             "movdqu 48(%1), %%xmm3\n\t"
+                             "movdqa %%xmm0, 0(%0)\n\t"
+                             "movdqa %%xmm1, 16(%0)\n\t"
+                             "movdqa %%xmm2, 32(%0)\n\t"
+                             "movdqa %%xmm3, 48(%0)\n\t"
+                             :
+                             : "r"(d), "r"(s)
+                             : "memory", "xmm0", "xmm1", "xmm2", "xmm3");
+        d += 64;
+        s += 64;
+        num -= 64;
+    }
+    fpu_restore(&state);
+
+    memcpy_words(d, s, num);
+    return dest;
+}
+
+static void *memset_sse2(void *ptr, int value, size_t num) {
+    if (num < SSE2_THRESHOLD) {
+        return memset_words(ptr, value, num);
+    }
+
+    uint8_t *p = (uint8_t*)ptr;
+    uint64_t pattern = (uint8_t)value * 0x0101010101010101ULL;
+
+    size_t head = (16 - ((uintptr_t)p & 15)) & 15;
+    memset_words(p, value, head);
+    p += head;
+    num -= head;
+
+    struct fpu_state state;
+    fpu_save(&state);
+    __asm__ __volatile__("movq %0, %%xmm0\n\t"
+                         "punpcklqdq %%xmm0, %%xmm0"
+                         :
+                         : "r"(pattern)
+                         : "xmm0");
+    while (num >= 64) {
+        __asm__ __volatile__("movdqa %%xmm0, 0(%0)\n\t"
+                             "movdqa %%xmm0, 16(%0)\n\t"
+                             "movdqa %%xmm0, 32(%0)\n\t"
+                             "movdqa %%xmm0, 48(%0)\n\t"
+                             :
+                             : "r"(p)
+                             : "memory");
+        p += 64;
+        num -= 64;
+    }
+    fpu_restore(&state);
+
+    memset_words(p, value, num);
+    return ptr;
+}
+
+/*
+ * Streaming variants write around the cache with non-temporal stores,
+ * for buffers that are far larger than the caches and not read back
+ * soon. The trailing sfence orders the weakly-ordered stores before any
+ * later store becomes visible.
+ */
+void *memcpy_nt(void *dest, const void *src, size_t num) {
+    uint8_t *d = (uint8_t*)dest;
+    const uint8_t *s = (const uint8_t*)src;
+
+    size_t head = (16 - ((uintptr_t)d & 15)) & 15;
+    if (head > num) {
+        head = num;
+    }
+    memcpy_words(d, s, head);
+    d += head;
+    s += head;
+    num -= head;
+
+    if (num >= 64) {
+        struct fpu_state state;
+        fpu_save(&state);
+        while (num >= 64) {
+            __asm__ __volatile__("movdqu 0(%1), %%xmm0\n\t"
+                                 "movdqu 16(%1), %%xmm1\n\t"
+                                 "movdqu 32(%1), %%xmm2\n\t"
+                                 "movdqu 48(%1), %%xmm3\n\t"
+                                 "movntdq %%xmm0, 0(%0)\n\t"
+                                 "movntdq %%xmm1, 16(%0)\n\t"
+                                 "movntdq %%xmm2, 32(%0)\n\t"
+                                 "movntdq %%xmm3, 48(%0)\n\t"
+                                 :
+                                 : "r"(d), "r"(s)
+                                 : "memory", "xmm0", "xmm1", "xmm2", "xmm3");
+            d += 64;
+            s += 64;
+            num -= 64;
+        }
+        __asm__ __volatile__("sfence" ::: "memory");
+        fpu_restore(&state);
+    }
+
+    memcpy_words(d, s, num);
+    return dest;
+}
+
+void *memset_nt(void *ptr, int value, size_t num) {
+    uint8_t *p = (uint8_t*)ptr;
+    uint64_t pattern = (uint8_t)value * 0x0101010101010101ULL;
+
+    size_t head = (8 - ((uintptr_t)p & 7)) & 7;
+    if (head > num) {
+        head = num;
+    }
+    memset_words(p, value, head);
+    p += head;
+    num -= head;
+
+    if (num >= 32) {
+        while (num >= 32) {
+            __asm__ __volatile__("movnti %1, 0(%0)\n\t"
+                                 "movnti %1, 8(%0)\n\t"
+                                 "movnti %1, 16(%0)\n\t"
+                                 "movnti %1, 24(%0)\n\t"
+                                 :
+                                 : "r"(p), "r"(pattern)
+                                 : "memory");
+            p += 32;
+            num -= 32;
+        }
+        __asm__ __volatile__("sfence" ::: "memory");
+    }
+
+    memset_words(p, value, num);
+    return ptr;
+}
+
+static void *memmove_backward(void *dest, const void *src, size_t num) {
+    uint8_t *d = (uint8_t*)dest + num;
+    const uint8_t *s = (const uint8_t*)src + num;
+    while (num >= 8) {
+        d -= 8;
+        s -= 8;
+        *(unaligned_u64*)d = *(const unaligned_u64*)s;
+        num -= 8;
+    }
+    while (num--) {
+        *--d = *--s;
     }
     return dest;
 }
 
+void string_initialize(void) {
+    uint32_t eax, ebx, ecx, edx;
+    uint32_t max_leaf;
+    cpuid(0, 0, &max_leaf, &ebx, &ecx, &edx);
+
+    uint32_t features7_ebx = 0, features7_edx = 0;
+    if (max_leaf >= 7) {
+        cpuid(7, 0, &eax, &features7_ebx, &ecx, &features7_edx);
+    }
+    cpuid(1, 0, &eax, &ebx, &ecx, &edx);
+
+    if (features7_edx & CPUID_7_EDX_FSRM) {
+        memcpy_impl = memcpy_erms;
+        memset_impl = memset_erms;
+        memcpy_forward_impl = memcpy_erms;
+        string_impl_name = "fsrm";
+    } else if (features7_ebx & CPUID_7_EBX_ERMS) {
+        memcpy_impl = memcpy_erms_small;
+        memset_impl = memset_erms_small;
+        memcpy_forward_impl = memcpy_erms_small;
+        string_impl_name = "erms";
+    } else if (edx & CPUID_1_EDX_SSE2) {
+        memcpy_impl = memcpy_sse2;
+        memset_impl = memset_sse2;
+        memcpy_forward_impl = memcpy_words;
+        string_impl_name = "sse2";
+    }
+}
+
+const char *string_implementation(void) {
+    return string_impl_name;
+}
+
+void *memset(void *ptr, int value, size_t num) {
+    return memset_impl(ptr, value, num);
+}
+
+void *memcpy(void *dest, const void *src, size_t num) {
+    return memcpy_impl(dest, src, num);
+}
+
+void *memmove(void *dest, const void *src, size_t num) {
+    uintptr_t d = (uintptr_t)dest;
+    uintptr_t s = (uintptr_t)src;
+    if (d == s || num == 0) {
+        return dest;
+    }
+    if (d < s || d >= s + num) {
+        return memcpy_forward_impl(dest, src, num);
+    }
+    return memmove_backward(dest, src, num);
+}
+
 char *strcpy(char *dest, const char *src) {
     char *d = dest;
     while (*src) {
@@ -31,4 +515,4 @@ char *strcpy(char *dest, const char *src) {
     }
     *d = '\0';
     return dest;
-}
\ No newline at end of file
+}
@@ -0,0 +1,82 @@
+#include <kernel/acpi.h>
+#include <kernel/memory.h>
+#include <limine.h>
+#include <string.h>
+
+static volatile struct limine_rsdp_request rsdp_request = {
+    .id = LIMINE_RSDP_REQUEST,
+    .revision = 0
+};
+
+static bool checksum_valid(const void *data, size_t length) {
+    const uint8_t *bytes = (const uint8_t*)data;
+    uint8_t sum = 0;
+    for (size_t i = 0; i < length; i++) {
+        sum += bytes[i];
+    }
+    return sum == 0;
+}
+
+/*
+ * Depending on the protocol base revision Limine reports the RSDP either
+ * through the HHDM or as a physical address; anything below the HHDM is
+ * taken to be physical.
+ */
+static const acpi_rsdp *find_rsdp(void) {
+    if (rsdp_request.response == NULL || rsdp_request.response->address == NULL) {
+        return NULL;
+    }
+
+    uint64_t address = (uint64_t)rsdp_request.response->address;
+    uint64_t hhdm = vmm()->get_hhdm_offset();
+    if (address < hhdm) {
+        address += hhdm;
+    }
+
+    const acpi_rsdp *rsdp = (const acpi_rsdp*)address;
+    if (memcmp(rsdp->signature, "RSD PTR ", 8) != 0 || !checksum_valid(rsdp, 20)) {
+        return NULL;
+    }
+    return rsdp;
+}
+
+static const acpi_sdt_header *map_table(uint64_t physical) {
+    return physical ? (const acpi_sdt_header*)vmm()->physicalToVirtual(physical) : NULL;
+}
+
+static bool table_matches(const acpi_sdt_header *table, const char *signature) {
+    return table && memcmp(table->signature, signature, 4) == 0 &&
+           checksum_valid(table, table->length);
+}
+
+const struct acpi_sdt_header *acpi_find_table(const char *signature) {
+    const acpi_rsdp *rsdp = find_rsdp();
+    if (!rsdp) return NULL;
+
+    /* The XSDT holds 64-bit pointers, the RSDT of ACPI 1.0 32-bit ones. */
+    if (rsdp->revision >= 2 && rsdp->xsdt_address && checksum_valid(rsdp, rsdp->length)) {
+        const acpi_sdt_header *xsdt = map_table(rsdp->xsdt_address);
+        if (table_matches(xsdt, "XSDT")) {
+            size_t count = (xsdt->length - sizeof(acpi_sdt_header)) / sizeof(uint64_t);
+            const uint8_t *entries = (const uint8_t*)(xsdt + 1);
+            for (size_t i = 0; i < count; i++) {
+                uint64_t address;
+                memcpy(&address, entries + i * sizeof(uint64_t), sizeof(address));
+                const acpi_sdt_header *table = map_table(address);
+                if (table_matches(table, signature)) return table;
+            }
+            return NULL;
+        }
+    }
+
+    const acpi_sdt_header *rsdt = map_table(rsdp->rsdt_address);
+    if (!table_matches(rsdt, "RSDT")) return NULL;
+
+    size_t count = (rsdt->length - sizeof(acpi_sdt_header)) / sizeof(uint32_t);
+    const uint32_t *entries = (const uint32_t*)(rsdt + 1);
+    for (size_t i = 0; i < count; i++) {
+        const acpi_sdt_header *table = map_table(entries[i]);
+        if (table_matches(table, signature)) return table;
+    }
+    return NULL;
+}
@@ -0,0 +1,148 @@
+#include <kernel/bench.h>
+
+#ifdef KERNEL_BENCH
+
+#include <kernel/cpu.h>
+#include <kernel/kfmt.h>
+#include <kernel/klog.h>
+#include <kernel/memory.h>
+#include <stdio.h>
+#include <string.h>
+
+static size_t bench_iterations(size_t size)
+{
+  size_t iterations = BENCH_BYTES_PER_SIZE / size;
+  return iterations < 4 ? 4 : iterations;
+}
+
+static size_t bench_rate(size_t bytes, uint64_t cycles)
+{
+  return cycles ? (size_t)(bytes * 1000 / cycles) : 0;
+}
+
+void bench_memory(void)
+{
+  uint8_t *src = (uint8_t *)vmm()->vmalloc(BENCH_MAX_SIZE + PAGE_SIZE);
+  uint8_t *dst = (uint8_t *)vmm()->vmalloc(BENCH_MAX_SIZE + PAGE_SIZE);
+  if (!src || !dst)
+  {
+    printf("BENCH: Failed to allocate buffers\n");
+    vmm()->vfree(src);
+    vmm()->vfree(dst);
+    return;
+  }
+
+  memset(src, 0x5A, BENCH_MAX_SIZE + PAGE_SIZE);
+  memset(dst, 0, BENCH_MAX_SIZE + PAGE_SIZE);
+
+  printf("\n=== Memory bandwidth (%s, bytes/kcycle) ===\n", string_implementation());
+  printf("size        memcpy      memset      memmove     memcpy_nt   memset_nt\n");
+
+  for (size_t size = BENCH_MIN_SIZE; size <= BENCH_MAX_SIZE; size <<= 1)
+  {
+    size_t iterations = bench_iterations(size);
+    size_t bytes = size * iterations;
+
+    uint64_t start = rdtsc();
+    for (size_t i = 0; i < iterations; i++)
+    {
+      memcpy(dst, src, size);
+    }
+    uint64_t copy_cycles = rdtsc() - start;
+
+    start = rdtsc();
+    for (size_t i = 0; i < iterations; i++)
+    {
+      memset(dst, (int)i, size);
+    }
+    uint64_t set_cycles = rdtsc() - start;
+
+    start = rdtsc();
+    for (size_t i = 0; i < iterations; i++)
+    {
+      memmove(src + 8, src, size);
+    }
+    uint64_t move_cycles = rdtsc() - start;
+
+    start = rdtsc();
+    for (size_t i = 0; i < iterations; i++)
+    {
+      memcpy_nt(dst, src, size);
+    }
+    uint64_t copy_nt_cycles = rdtsc() - start;
+
+    start = rdtsc();
+    for (size_t i = 0; i < iterations; i++)
+    {
+      memset_nt(dst, (int)i, size);
+    }
+    uint64_t set_nt_cycles = rdtsc() - start;
+
+    printf("%zu  %zu  %zu  %zu  %zu  %zu\n", size,
+           bench_rate(bytes, copy_cycles),
+           bench_rate(bytes, set_cycles),
+           bench_rate(bytes, move_cycles),
+           bench_rate(bytes, copy_nt_cycles),
+           bench_rate(bytes, set_nt_cycles));
+  }
+
+  vmm()->vfree(src);
+  vmm()->vfree(dst);
+}
+
+static uint64_t bench_cycles_per_call(uint64_t cycles)
+{
+  return cycles / BENCH_FORMAT_ITERATIONS;
+}
+
+void bench_format(void)
+{
+  char line[128];
+  uint64_t base = 0x00000000000A0000;
+  uint64_t length = 0x000000007FEE0000;
+
+  printf("\n=== Formatting (cycles/call) ===\n");
+
+  uint64_t start = rdtsc();
+  for (size_t i = 0; i < BENCH_FORMAT_ITERATIONS; i++)
+  {
+    snprintf(line, sizeof(line), "%d", (int)(i * 7919));
+  }
+  printf("%%d          %zu\n", bench_cycles_per_call(rdtsc() - start));
+
+  start = rdtsc();
+  for (size_t i = 0; i < BENCH_FORMAT_ITERATIONS; i++)
+  {
+    snprintf(line, sizeof(line), "%p", (void *)(base + i * PAGE_SIZE));
+  }
+  printf("%%p          %zu\n", bench_cycles_per_call(rdtsc() - start));
+
+  start = rdtsc();
+  for (size_t i = 0; i < BENCH_FORMAT_ITERATIONS; i++)
+  {
+    snprintf(line, sizeof(line), " %d  %p  %p  %lu %s  %s\n",
+             (int)(i & 31), (void *)base, (void *)(base + length - 1),
+             (unsigned long)(length >> 20), "MB", "USABLE");
+  }
+  printf("memmap row  %zu\n", bench_cycles_per_call(rdtsc() - start));
+
+  start = rdtsc();
+  for (size_t i = 0; i < BENCH_FORMAT_ITERATIONS; i++)
+  {
+    kfmt::format<" {}  {:p}  {:p}  {} {}  {}\n">(
+        line, sizeof(line), i & 31, base, base + length - 1,
+        length >> 20, "MB", "USABLE");
+  }
+  printf("memmap row (kfmt)  %zu\n", bench_cycles_per_call(rdtsc() - start));
+
+  start = rdtsc();
+  for (size_t i = 0; i < BENCH_FORMAT_ITERATIONS; i++)
+  {
+    klog<" {}  {:p}  {:p}  {} MB  {}\n">(
+        i & 31, base, base + length - 1, length >> 20, "USABLE");
+  }
+  printf("memmap row (klog)  %zu\n", bench_cycles_per_call(rdtsc() - start));
+  klog_discard();
+}
+
+#endif
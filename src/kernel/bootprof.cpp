@@ -0,0 +1,103 @@
+#include <kernel/bootprof.h>
+#include <kernel/clock.h>
+#include <kernel/cpu.h>
+#include <kernel/kfmt.h>
+#include <kernel/serial.h>
+#include <limine.h>
+
+static volatile struct limine_boot_time_request boot_time_request = {
+    .id = LIMINE_BOOT_TIME_REQUEST,
+    .revision = 0
+};
+
+struct boot_phase_record {
+    const char *name;
+    uint64_t start;
+    uint64_t end;
+};
+
+static boot_phase_record phases[BOOTPROF_MAX_PHASES];
+static size_t phase_count = 0;
+static bool phase_open = false;
+static uint64_t entry_tsc = 0;
+
+/* Call first thing in kernel_main. */
+void bootprof_initialize(void) {
+    entry_tsc = rdtsc();
+    phases[0] = {BOOTPROF_PRE_KERNEL, 0, entry_tsc};
+    phase_count = 1;
+    phase_open = false;
+}
+
+static void close_phase(uint64_t now) {
+    if (phase_open) {
+        phases[phase_count - 1].end = now;
+        phase_open = false;
+    }
+}
+
+void boot_phase(const char *name) {
+    uint64_t now = rdtsc();
+    close_phase(now);
+    if (phase_count == BOOTPROF_MAX_PHASES) return;
+
+    phases[phase_count++] = {name, now, now};
+    phase_open = true;
+}
+
+static inline uint64_t phase_cycles(const boot_phase_record *phase) {
+    return phase->end - phase->start;
+}
+
+static void print_breakdown(uint64_t total_ns) {
+    size_t order[BOOTPROF_MAX_PHASES];
+    for (size_t i = 0; i < phase_count; i++) {
+        size_t j = i;
+        for (; j > 0 && phase_cycles(&phases[order[j - 1]]) < phase_cycles(&phases[i]); j--) {
+            order[j] = order[j - 1];
+        }
+        order[j] = i;
+    }
+
+    uint64_t kernel_ns = total_ns - clock_cycles_to_ns(phase_cycles(&phases[0]));
+    kfmt::print<"Boot time: {}.{:03} ms since reset, {}.{:03} ms in kernel_main\n">(
+        total_ns / 1000000, total_ns / 1000 % 1000, kernel_ns / 1000000, kernel_ns / 1000 % 1000);
+    for (size_t i = 0; i < phase_count; i++) {
+        const boot_phase_record *phase = &phases[order[i]];
+        uint64_t ns = clock_cycles_to_ns(phase_cycles(phase));
+        uint64_t permille = total_ns ? ns * 1000 / total_ns : 0;
+        kfmt::print<"  {:<28} {:>8}.{:03} ms {:>3}.{}%\n">(
+            phase->name, ns / 1000000, ns / 1000 % 1000, permille / 10, permille % 10);
+    }
+}
+
+static void export_phases(uint64_t total_ns) {
+    serial_writer writer;
+    writer.length = 0;
+
+    int64_t boot_time = boot_time_request.response ? boot_time_request.response->boot_time : 0;
+    kfmt::format_to<"BOOTPROF {{\"boot_time\":{},\"tsc_hz\":{},\"total_ns\":{},\"phases\":[">(
+        serial_writer_write, &writer, boot_time, clock_tsc_frequency(), total_ns);
+    for (size_t i = 0; i < phase_count; i++) {
+        const boot_phase_record *phase = &phases[i];
+        kfmt::format_to<"{}{{\"name\":\"{}\",\"start_ns\":{},\"duration_ns\":{},\"cycles\":{}}}">(
+            serial_writer_write, &writer, i ? "," : "", phase->name,
+            clock_cycles_to_ns(phase->start), clock_cycles_to_ns(phase_cycles(phase)),
+            phase_cycles(phase));
+    }
+    kfmt::format_to<"]}}\n">(serial_writer_write, &writer);
+    serial_writer_flush(&writer);
+}
+
+/*
+ * Ends the last phase and reports. Durations need the calibrated TSC
+ * frequency, so this runs after clock_initialize.
+ */
+void bootprof_finish(void) {
+    uint64_t now = rdtsc();
+    close_phase(now);
+
+    uint64_t total_ns = clock_cycles_to_ns(now);
+    print_breakdown(total_ns);
+    export_phases(total_ns);
+}
@@ -0,0 +1,207 @@
+#include <kernel/clock.h>
+#include <kernel/acpi.h>
+#include <kernel/cpu.h>
+#include <kernel/interrupt.h>
+#include <kernel/klog.h>
+#include <kernel/memory.h>
+
+#define PIT_FREQUENCY 1193182
+#define PIT_CHANNEL2 0x42
+#define PIT_COMMAND 0x43
+#define PIT_GATE_PORT 0x61
+
+#define HPET_CAPABILITIES 0x000
+#define HPET_CONFIGURATION 0x010
+#define HPET_MAIN_COUNTER 0x0F0
+#define HPET_CAP_COUNTER_64BIT (1ull << 13)
+#define HPET_CONFIG_ENABLE 0x1
+#define HPET_MAX_PERIOD_FS 100000000ull
+
+/* Gives up on a PIT that never counts down after this many TSC cycles. */
+#define PIT_TIMEOUT_CYCLES (1ull << 36)
+
+static clock_source source = CLOCK_SOURCE_NONE;
+static uint64_t tsc_frequency = 0;
+static uint64_t tsc_mult = 0;
+static uint64_t tsc_base = 0;
+
+static volatile uint8_t *hpet = NULL;
+static uint64_t hpet_period_fs = 0;
+static uint64_t hpet_mult = 0;
+static uint64_t hpet_base = 0;
+static bool hpet_64bit = false;
+
+static inline uint64_t scale(uint64_t delta, uint64_t mult) {
+    return (uint64_t)(((unsigned __int128)delta * mult) >> CLOCK_SHIFT);
+}
+
+static inline uint64_t hpet_read(size_t reg) {
+    return *(volatile uint64_t*)(hpet + reg);
+}
+
+static inline void hpet_write(size_t reg, uint64_t value) {
+    *(volatile uint64_t*)(hpet + reg) = value;
+}
+
+static inline uint64_t hpet_counter(void) {
+    return hpet_64bit ? hpet_read(HPET_MAIN_COUNTER) : *(volatile uint32_t*)(hpet + HPET_MAIN_COUNTER);
+}
+
+static bool tsc_invariant(void) {
+    uint32_t eax, ebx, ecx, edx;
+    cpuid(0x80000000, 0, &eax, &ebx, &ecx, &edx);
+    if (eax < 0x80000007) return false;
+    cpuid(0x80000007, 0, &eax, &ebx, &ecx, &edx);
+    return (edx & CPUID_80000007_EDX_INVARIANT_TSC) != 0;
+}
+
+/* Leaf 0x15 gives the TSC as a ratio of the crystal clock, where enumerated. */
+static uint64_t tsc_frequency_from_cpuid(void) {
+    uint32_t eax, ebx, ecx, edx;
+    cpuid(0, 0, &eax, &ebx, &ecx, &edx);
+    if (eax < 0x15) return 0;
+    cpuid(0x15, 0, &eax, &ebx, &ecx, &edx);
+    if (eax == 0 || ebx == 0 || ecx == 0) return 0;
+    return (uint64_t)ecx * ebx / eax;
+}
+
+static bool hpet_initialize(void) {
+    const acpi_hpet *table = (const acpi_hpet*)acpi_find_table("HPET");
+    if (!table || table->base_address.address_space_id != ACPI_GAS_SYSTEM_MEMORY) return false;
+
+    /* The HHDM covers the HPET with cacheable large pages; map it on its own. */
+    hpet = (volatile uint8_t*)vmm()->ioremap(table->base_address.address, PAGE_SIZE,
+                                             WRITABLE | CACHE_DISABLE | NO_EXECUTE);
+    if (!hpet) return false;
+
+    uint64_t capabilities = hpet_read(HPET_CAPABILITIES);
+    hpet_period_fs = capabilities >> 32;
+    if (hpet_period_fs == 0 || hpet_period_fs > HPET_MAX_PERIOD_FS) {
+        vmm()->iounmap((void*)hpet);
+        hpet = NULL;
+        return false;
+    }
+    hpet_64bit = (capabilities & HPET_CAP_COUNTER_64BIT) != 0;
+    hpet_write(HPET_CONFIGURATION, hpet_read(HPET_CONFIGURATION) | HPET_CONFIG_ENABLE);
+    return true;
+}
+
+static uint64_t calibrate_hpet(void) {
+    uint64_t mask = hpet_64bit ? UINT64_MAX : UINT32_MAX;
+    uint64_t ticks = CLOCK_CALIBRATION_MS * 1000000000000ull / hpet_period_fs;
+
+    uint64_t start = hpet_counter();
+    uint64_t tsc_start = rdtsc();
+    uint64_t now;
+    while ((((now = hpet_counter()) - start) & mask) < ticks) {
+        __builtin_ia32_pause();
+    }
+    uint64_t tsc_end = rdtsc();
+
+    uint64_t nanoseconds = ((now - start) & mask) * hpet_period_fs / 1000000;
+    return (tsc_end - tsc_start) * 1000000000 / nanoseconds;
+}
+
+/*
+ * Counts PIT channel 2 down once in mode 0 with the speaker disconnected;
+ * its output shows up in bit 5 of port 0x61 when the count expires.
+ */
+static uint64_t calibrate_pit(void) {
+    uint32_t latch = PIT_FREQUENCY * CLOCK_CALIBRATION_MS / 1000;
+    uint8_t gate = inb(PIT_GATE_PORT);
+    outb(PIT_GATE_PORT, (gate & ~0x02) | 0x01);
+    outb(PIT_COMMAND, 0xB0);
+    outb(PIT_CHANNEL2, (uint8_t)latch);
+    outb(PIT_CHANNEL2, (uint8_t)(latch >> 8));
+
+    uint64_t tsc_start = rdtsc();
+    uint64_t tsc_end = tsc_start;
+    while (!(inb(PIT_GATE_PORT) & 0x20)) {
+        tsc_end = rdtsc();
+        if (tsc_end - tsc_start > PIT_TIMEOUT_CYCLES) {
+            outb(PIT_GATE_PORT, gate);
+            return 0;
+        }
+    }
+    tsc_end = rdtsc();
+    outb(PIT_GATE_PORT, gate);
+
+    return (tsc_end - tsc_start) * PIT_FREQUENCY / latch;
+}
+
+/*
+ * Anything that interrupts a calibration round only makes the TSC look
+ * faster, so the lowest result of a few rounds is kept.
+ */
+static uint64_t calibrate_tsc(bool use_hpet) {
+    uint64_t flags = interrupt_save();
+    uint64_t best = 0;
+    for (size_t round = 0; round < CLOCK_CALIBRATION_ROUNDS; round++) {
+        uint64_t frequency = use_hpet ? calibrate_hpet() : calibrate_pit();
+        if (frequency && (best == 0 || frequency < best)) {
+            best = frequency;
+        }
+    }
+    interrupt_restore(flags);
+    return best;
+}
+
+void clock_initialize(void) {
+    bool invariant = tsc_invariant();
+    bool have_hpet = hpet_initialize();
+
+    const char *reference = "CPUID";
+    tsc_frequency = tsc_frequency_from_cpuid();
+    if (!tsc_frequency) {
+        tsc_frequency = calibrate_tsc(have_hpet);
+        reference = have_hpet ? "HPET" : "PIT";
+    }
+    if (tsc_frequency) {
+        tsc_mult = (1000000000ull << CLOCK_SHIFT) / tsc_frequency;
+    }
+    if (have_hpet) {
+        hpet_mult = (hpet_period_fs << CLOCK_SHIFT) / 1000000;
+    }
+
+    if (tsc_frequency && invariant) {
+        source = CLOCK_SOURCE_TSC;
+    } else if (have_hpet && hpet_64bit) {
+        source = CLOCK_SOURCE_HPET;
+    } else if (tsc_frequency) {
+        source = CLOCK_SOURCE_TSC;
+    }
+    tsc_base = rdtsc();
+    if (have_hpet) {
+        hpet_base = hpet_counter();
+    }
+
+    klog<"CLOCK: TSC {} kHz from {}, {}\n">(tsc_frequency / 1000, reference,
+                                              invariant ? "invariant" : "not invariant");
+    if (have_hpet) {
+        klog<"CLOCK: HPET period {} fs, {}-bit counter\n">(hpet_period_fs, hpet_64bit ? 64 : 32);
+    }
+    klog<"CLOCK: Using {}\n">(source == CLOCK_SOURCE_TSC ? "TSC" : source == CLOCK_SOURCE_HPET ? "HPET" : "no clock");
+}
+
+clock_source clock_get_source(void) {
+    return source;
+}
+
+uint64_t clock_tsc_frequency(void) {
+    return tsc_frequency;
+}
+
+uint64_t ktime_ns(void) {
+    switch (source) {
+        case CLOCK_SOURCE_TSC:
+            return scale(rdtsc() - tsc_base, tsc_mult);
+        case CLOCK_SOURCE_HPET:
+            return scale(hpet_counter() - hpet_base, hpet_mult);
+        default:
+            return 0;
+    }
+}
+
+uint64_t clock_cycles_to_ns(uint64_t cycles) {
+    return scale(cycles, tsc_mult);
+}
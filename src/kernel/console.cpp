@@ -0,0 +1,194 @@
+#include <kernel/console.h>
+#include <kernel/debugcon.h>
+#include <kernel/serial.h>
+#include <kernel/terminal.h>
+#include <stdio.h>
+#include <string.h>
+
+/*
+ * Bounded MPMC ring in the style of Vyukov's queue, used with a single
+ * consumer. A slot at position pos is free when its sequence equals pos
+ * and holds data when it equals pos + 1. A writer claims all the slots
+ * for one message with a single compare-and-swap on enqueue_pos, so
+ * concurrent messages are never interleaved, and publishes each slot by
+ * storing its sequence. Slots are consumed in order, so checking that the
+ * last slot of a run is free is enough to know the whole run is.
+ */
+struct console_slot {
+    uint64_t sequence;
+    uint32_t length;
+    char data[CONSOLE_SLOT_DATA];
+};
+
+static_assert(sizeof(console_slot) == 64, "console_slot should fill one cache line");
+static_assert((CONSOLE_QUEUE_SLOTS & (CONSOLE_QUEUE_SLOTS - 1)) == 0,
+              "CONSOLE_QUEUE_SLOTS must be a power of two");
+
+static console_slot slots[CONSOLE_QUEUE_SLOTS] __attribute__((aligned(64)));
+static uint64_t enqueue_pos __attribute__((aligned(64))) = 0;
+static uint64_t dequeue_pos __attribute__((aligned(64))) = 0;
+static uint64_t dropped_bytes = 0;
+static int draining = 0;
+static bool console_ready = false;
+static bool console_panicked = false;
+static console_overflow_policy overflow_policy = CONSOLE_OVERFLOW_BLOCK;
+
+static void console_output(const char *data, size_t size) {
+    debugcon_write(data, size);
+    terminal_write(data, size);
+}
+
+void console_initialize(void) {
+    for (size_t i = 0; i < CONSOLE_QUEUE_SLOTS; i++) {
+        slots[i].sequence = i;
+    }
+    enqueue_pos = 0;
+    dequeue_pos = 0;
+    __atomic_store_n(&console_ready, true, __ATOMIC_RELEASE);
+}
+
+static bool console_reserve(size_t count, uint64_t *out) {
+    uint64_t pos = __atomic_load_n(&enqueue_pos, __ATOMIC_RELAXED);
+    for (;;) {
+        uint64_t last = pos + count - 1;
+        console_slot *slot = &slots[last & (CONSOLE_QUEUE_SLOTS - 1)];
+        int64_t diff = (int64_t)(__atomic_load_n(&slot->sequence, __ATOMIC_ACQUIRE) - last);
+        if (diff == 0) {
+            if (__atomic_compare_exchange_n(&enqueue_pos, &pos, pos + count, true,
+                                            __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+                *out = pos;
+                return true;
+            }
+        } else if (diff < 0) {
+            return false;
+        } else {
+            pos = __atomic_load_n(&enqueue_pos, __ATOMIC_RELAXED);
+        }
+    }
+}
+
+static bool console_enqueue(const char *data, size_t size) {
+    size_t count = (size + CONSOLE_SLOT_DATA - 1) / CONSOLE_SLOT_DATA;
+    uint64_t pos;
+
+    uint64_t seen = __atomic_load_n(&dequeue_pos, __ATOMIC_RELAXED);
+    size_t spins = 0;
+    while (!console_reserve(count, &pos)) {
+        if (overflow_policy != CONSOLE_OVERFLOW_BLOCK) {
+            return false;
+        }
+
+        /*
+         * Blocking drains in place, or waits while another CPU drains. If
+         * the queue makes no progress for CONSOLE_BLOCK_SPINS rounds the
+         * consumer or the writer of the oldest slot is a context we
+         * interrupted, and waiting would never end.
+         */
+        if (console_drain() == 0) {
+            uint64_t now = __atomic_load_n(&dequeue_pos, __ATOMIC_RELAXED);
+            if (now != seen) {
+                seen = now;
+                spins = 0;
+            } else if (++spins >= CONSOLE_BLOCK_SPINS) {
+                return false;
+            }
+            __asm__ __volatile__("pause");
+        }
+    }
+
+    for (size_t i = 0; i < count; i++) {
+        console_slot *slot = &slots[(pos + i) & (CONSOLE_QUEUE_SLOTS - 1)];
+        size_t length = size < CONSOLE_SLOT_DATA ? size : CONSOLE_SLOT_DATA;
+        memcpy(slot->data, data, length);
+        slot->length = (uint32_t)length;
+        __atomic_store_n(&slot->sequence, pos + i + 1, __ATOMIC_RELEASE);
+        data += length;
+        size -= length;
+    }
+    return true;
+}
+
+void console_queue_write(const char *data, size_t size) {
+    if (!__atomic_load_n(&console_ready, __ATOMIC_ACQUIRE) ||
+        __atomic_load_n(&console_panicked, __ATOMIC_RELAXED)) {
+        console_output(data, size);
+        return;
+    }
+
+    while (size) {
+        size_t chunk = size < CONSOLE_MAX_RESERVE * CONSOLE_SLOT_DATA
+                           ? size : CONSOLE_MAX_RESERVE * CONSOLE_SLOT_DATA;
+        if (!console_enqueue(data, chunk)) {
+            __atomic_fetch_add(&dropped_bytes, size, __ATOMIC_RELAXED);
+            return;
+        }
+        data += chunk;
+        size -= chunk;
+    }
+}
+
+static size_t console_drain_locked(void) {
+    char batch[1024];
+    size_t length = 0;
+    size_t drained = 0;
+
+    for (;;) {
+        console_slot *slot = &slots[dequeue_pos & (CONSOLE_QUEUE_SLOTS - 1)];
+        if (__atomic_load_n(&slot->sequence, __ATOMIC_ACQUIRE) != dequeue_pos + 1) {
+            break;
+        }
+
+        if (length + slot->length > sizeof(batch)) {
+            console_output(batch, length);
+            length = 0;
+        }
+        memcpy(batch + length, slot->data, slot->length);
+        length += slot->length;
+        drained += slot->length;
+
+        __atomic_store_n(&slot->sequence, dequeue_pos + CONSOLE_QUEUE_SLOTS, __ATOMIC_RELEASE);
+        __atomic_store_n(&dequeue_pos, dequeue_pos + 1, __ATOMIC_RELAXED);
+    }
+
+    if (length) {
+        console_output(batch, length);
+    }
+
+    uint64_t dropped = __atomic_exchange_n(&dropped_bytes, 0, __ATOMIC_RELAXED);
+    if (dropped) {
+        length = snprintf(batch, sizeof(batch), "\n[console: %lu bytes dropped]\n", dropped);
+        console_output(batch, length);
+    }
+    return drained;
+}
+
+size_t console_drain(void) {
+    if (__atomic_exchange_n(&draining, 1, __ATOMIC_ACQUIRE)) {
+        return 0;
+    }
+    size_t drained = console_drain_locked();
+    __atomic_store_n(&draining, 0, __ATOMIC_RELEASE);
+    return drained;
+}
+
+void console_set_overflow_policy(console_overflow_policy policy) {
+    overflow_policy = policy;
+}
+
+uint64_t console_dropped_bytes(void) {
+    return __atomic_load_n(&dropped_bytes, __ATOMIC_RELAXED);
+}
+
+/*
+ * Switches to synchronous output for good and writes out whatever is
+ * queued, taking over the drain even if another context was in the
+ * middle of one. Text from writers that never finished publishing their
+ * slots is lost.
+ */
+void console_panic_flush(void) {
+    __atomic_store_n(&console_panicked, true, __ATOMIC_RELAXED);
+    serial_panic_flush();
+    __atomic_exchange_n(&draining, 1, __ATOMIC_ACQUIRE);
+    console_drain_locked();
+    terminal_flush();
+}
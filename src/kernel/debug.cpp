@@ -1,44 +1,112 @@
 #include <kernel/debug.h>
-#include <kernel/serial.h>
+#include <kernel/debugcon.h>
 #include <stdarg.h>
 #include <stdio.h>
+#include <string.h>
 
-void hex_dump(const void *data, size_t size) {
-    const uint8_t *bytes = (const uint8_t*)data;
-    
-    for (size_t i = 0; i < size; i += 16) {
-        char line[80];
-        char *ptr = line;
-        
-        ptr += sprintf(ptr, "%08zx: ", i);
-        
-        for (size_t j = 0; j < 16; j++) {
-            if (i + j < size) {
-                ptr += sprintf(ptr, "%02x ", bytes[i + j]);
-            } else {
-                ptr += sprintf(ptr, "   ");
-            }
-            
-            if (j == 7) {
-                ptr += sprintf(ptr, " ");
-            }
+/*
+ * Worst case line: 16 address digits, ": ", 16 "xx " groups, the extra
+ * space after the eighth byte, a separator, 16 characters and '\n'.
+ */
+#define HEX_DUMP_LINE_MAX (16 + 2 + HEX_DUMP_BYTES_PER_LINE * 3 + 1 + 1 + HEX_DUMP_BYTES_PER_LINE + 1)
+
+struct hex_table {
+    char pairs[256][2];
+    char printable[256];
+};
+
+static constexpr hex_table make_hex_table() {
+    const char digits[] = "0123456789abcdef";
+    hex_table table = {};
+    for (int i = 0; i < 256; i++) {
+        table.pairs[i][0] = digits[i >> 4];
+        table.pairs[i][1] = digits[i & 0xF];
+        table.printable[i] = (i >= 32 && i < 127) ? (char)i : '.';
+    }
+    return table;
+}
+
+static constexpr hex_table hex = make_hex_table();
+
+static char *hex_dump_address(char *out, uint64_t address, int digits) {
+    for (int shift = (digits - 2) * 4; shift >= 0; shift -= 8) {
+        const char *pair = hex.pairs[(address >> shift) & 0xFF];
+        *out++ = pair[0];
+        *out++ = pair[1];
+    }
+    *out++ = ':';
+    *out++ = ' ';
+    return out;
+}
+
+static size_t hex_dump_line(char *line, uint64_t address, int digits,
+                            const uint8_t *bytes, size_t count) {
+    char *out = hex_dump_address(line, address, digits);
+    char *ascii = out + HEX_DUMP_BYTES_PER_LINE * 3 + 2;
+
+    for (size_t j = 0; j < HEX_DUMP_BYTES_PER_LINE; j++) {
+        if (j < count) {
+            const char *pair = hex.pairs[bytes[j]];
+            out[0] = pair[0];
+            out[1] = pair[1];
+            ascii[j] = hex.printable[bytes[j]];
+        } else {
+            out[0] = ' ';
+            out[1] = ' ';
+            ascii[j] = ' ';
+        }
+        out[2] = ' ';
+        out += 3;
+        if (j == 7) {
+            *out++ = ' ';
         }
-        
-        ptr += sprintf(ptr, " ");
-        
-        for (size_t j = 0; j < 16; j++) {
-            if (i + j < size) {
-                uint8_t c = bytes[i + j];
-                ptr += sprintf(ptr, "%c", (c >= 32 && c < 127) ? c : '.');
-            } else {
-                ptr += sprintf(ptr, " ");
+    }
+    *out++ = ' ';
+    ascii[HEX_DUMP_BYTES_PER_LINE] = '\n';
+    return ascii + HEX_DUMP_BYTES_PER_LINE + 1 - line;
+}
+
+void hex_dump_to(printf_callback_t callback, void *ctx, const void *data, size_t size) {
+    const uint8_t *bytes = (const uint8_t *)data;
+    uint64_t start = (uint64_t)bytes;
+
+    if (!bytes || size == 0) {
+        return;
+    }
+    if (start + size < start) {
+        size = (size_t)(0 - start);
+    }
+
+    uint64_t last = start + size - 1;
+    int digits = last > 0xFFFFFFFF ? 16 : 8;
+    char line[HEX_DUMP_LINE_MAX];
+    bool collapsing = false;
+
+    for (size_t i = 0; i < size; i += HEX_DUMP_BYTES_PER_LINE) {
+        size_t count = size - i < HEX_DUMP_BYTES_PER_LINE ? size - i : HEX_DUMP_BYTES_PER_LINE;
+
+        if (i > 0 && count == HEX_DUMP_BYTES_PER_LINE && i + count < size &&
+            memcmp(bytes + i, bytes + i - HEX_DUMP_BYTES_PER_LINE, HEX_DUMP_BYTES_PER_LINE) == 0) {
+            if (!collapsing) {
+                callback(ctx, "*\n", 2);
+                collapsing = true;
             }
+            continue;
         }
-        
-        DEBUG(DEBUG_VERBOSE, "%s", line);
+        collapsing = false;
+
+        size_t length = hex_dump_line(line, start + i, digits, bytes + i, count);
+        callback(ctx, line, length);
     }
 }
 
+void hex_dump(const void *data, size_t size) {
+    debugcon_writer writer;
+    writer.length = 0;
+    hex_dump_to(debugcon_writer_write, &writer, data, size);
+    debugcon_writer_flush(&writer);
+}
+
 const char *debug_level_string(int level) {
     switch (level) {
         case DEBUG_ERROR:   return "ERROR";
@@ -52,8 +120,6 @@ const char *debug_level_string(int level) {
 void debug_printf(const char *fmt, ...) {
     va_list args;
     va_start(args, fmt);
-   
-    serial_printf(fmt);
-    
+    debugcon_vprintf(fmt, args);
     va_end(args);
-}
\ No newline at end of file
+}
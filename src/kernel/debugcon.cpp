@@ -0,0 +1,116 @@
+#include <kernel/debugcon.h>
+#include <kernel/serial.h>
+#include <kernel/virtio.h>
+#include <kernel/cpu.h>
+#include <limine.h>
+#include <stdio.h>
+#include <string.h>
+
+static volatile struct limine_kernel_file_request kernel_file_request = {
+    .id = LIMINE_KERNEL_FILE_REQUEST,
+    .revision = 0
+};
+
+static debugcon_backend backend = DEBUGCON_SERIAL;
+
+/*
+ * Finds key=value among the space separated options and returns a
+ * pointer to the value, with its length in *length.
+ */
+static const char *cmdline_option(const char *cmdline, const char *key, size_t *length) {
+    size_t key_length = strlen(key);
+    const char *p = cmdline;
+    while (*p) {
+        while (*p == ' ') p++;
+        const char *end = p;
+        while (*end && *end != ' ') end++;
+        if ((size_t)(end - p) > key_length && memcmp(p, key, key_length) == 0 && p[key_length] == '=') {
+            *length = end - p - key_length - 1;
+            return p + key_length + 1;
+        }
+        p = end;
+    }
+    return NULL;
+}
+
+static bool option_is(const char *value, size_t length, const char *name) {
+    return strlen(name) == length && memcmp(value, name, length) == 0;
+}
+
+/* Reading the debug port returns 0xE9 when the emulator provides it. */
+static bool e9_present(void) {
+    return inb(DEBUGCON_E9_PORT) == DEBUGCON_E9_PORT;
+}
+
+/* The virtio backend needs the PMM and VMM, so this runs after both. */
+void debugcon_initialize(void) {
+    if (kernel_file_request.response == NULL || kernel_file_request.response->kernel_file == NULL ||
+        kernel_file_request.response->kernel_file->cmdline == NULL) {
+        return;
+    }
+
+    size_t length;
+    const char *value = cmdline_option(kernel_file_request.response->kernel_file->cmdline, "debugcon", &length);
+    if (!value) return;
+
+    if (option_is(value, length, "e9")) {
+        if (e9_present()) {
+            backend = DEBUGCON_E9;
+        } else {
+            printf("DEBUGCON: Port 0xE9 not present, staying on serial\n");
+        }
+    } else if (option_is(value, length, "virtio")) {
+        if (virtio_console_initialize()) {
+            backend = DEBUGCON_VIRTIO;
+        } else {
+            printf("DEBUGCON: No virtio console, staying on serial\n");
+        }
+    } else if (!option_is(value, length, "serial")) {
+        printf("DEBUGCON: Unknown backend, staying on serial\n");
+    }
+}
+
+debugcon_backend debugcon_get_backend(void) {
+    return backend;
+}
+
+void debugcon_write(const char *data, size_t size) {
+    switch (backend) {
+        case DEBUGCON_E9:
+            outsb(DEBUGCON_E9_PORT, data, size);
+            break;
+        case DEBUGCON_VIRTIO:
+            virtio_console_write(data, size);
+            break;
+        default:
+            serial_write_buffer(data, size);
+            break;
+    }
+}
+
+void debugcon_vprintf(const char *fmt, va_list args) {
+    debugcon_writer writer;
+    writer.length = 0;
+    vcbprintf(debugcon_writer_write, &writer, fmt, args);
+    debugcon_writer_flush(&writer);
+}
+
+void debugcon_writer_write(void *ctx, const char *data, size_t size) {
+    debugcon_writer *writer = (debugcon_writer *)ctx;
+    if (writer->length + size > DEBUGCON_WRITER_SIZE) {
+        debugcon_writer_flush(writer);
+        if (size > DEBUGCON_WRITER_SIZE) {
+            debugcon_write(data, size);
+            return;
+        }
+    }
+    memcpy(writer->buffer + writer->length, data, size);
+    writer->length += size;
+}
+
+void debugcon_writer_flush(debugcon_writer *writer) {
+    if (writer->length) {
+        debugcon_write(writer->buffer, writer->length);
+        writer->length = 0;
+    }
+}
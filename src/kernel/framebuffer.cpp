@@ -0,0 +1,231 @@
+#include <kernel/framebuffer.h>
+#include <string.h>
+
+typedef uint64_t __attribute__((may_alias, aligned(1))) unaligned_u64;
+typedef uint32_t __attribute__((may_alias, aligned(1))) unaligned_u32;
+typedef uint16_t __attribute__((may_alias, aligned(1))) unaligned_u16;
+typedef uint64_t __attribute__((may_alias)) aligned_u64;
+
+static constexpr uint32_t scale_channel(uint32_t value, uint32_t size) {
+    return size <= 8 ? value >> (8 - size) : value << (size - 8);
+}
+
+static constexpr uint32_t pack_rgb(uint32_t rgb,
+                                   uint32_t red_size, uint32_t red_shift,
+                                   uint32_t green_size, uint32_t green_shift,
+                                   uint32_t blue_size, uint32_t blue_shift) {
+    return scale_channel((rgb >> 16) & 0xFF, red_size) << red_shift |
+           scale_channel((rgb >> 8) & 0xFF, green_size) << green_shift |
+           scale_channel(rgb & 0xFF, blue_size) << blue_shift;
+}
+
+/* Channel layouts known at compile time. */
+template <uint32_t RS, uint32_t RSh, uint32_t GS, uint32_t GSh, uint32_t BS, uint32_t BSh>
+struct FixedLayout {
+    static uint32_t pack(uint32_t rgb) {
+        return pack_rgb(rgb, RS, RSh, GS, GSh, BS, BSh);
+    }
+};
+
+/* Any other layout, taken from the framebuffer in fb_select_renderer. */
+static struct {
+    uint8_t red_size, red_shift;
+    uint8_t green_size, green_shift;
+    uint8_t blue_size, blue_shift;
+} runtime_layout;
+
+struct RuntimeLayout {
+    static uint32_t pack(uint32_t rgb) {
+        return pack_rgb(rgb, runtime_layout.red_size, runtime_layout.red_shift,
+                        runtime_layout.green_size, runtime_layout.green_shift,
+                        runtime_layout.blue_size, runtime_layout.blue_shift);
+    }
+};
+
+static inline void store_word(uint64_t *p, uint64_t value, bool nt) {
+    if (nt) {
+        __asm__ __volatile__("movnti %1, %0" : "=m"(*p) : "r"(value));
+    } else {
+        *p = value;
+    }
+}
+
+/*
+ * Fills size bytes with a repeating pixel of the given size. Bytes up to
+ * the first 8-byte boundary and after the last one are stored singly;
+ * everything in between is streamed as 64-bit words. A pixel pattern
+ * repeats every 24 bytes for all supported sizes, so three words cover
+ * one period regardless of where the aligned part starts.
+ */
+template <size_t Bytes>
+static void fill_span(uint8_t *dst, size_t size, uint32_t pixel, bool nt) {
+    size_t phase = 0;
+    while (size && ((uintptr_t)dst & 7)) {
+        *dst++ = (uint8_t)(pixel >> (8 * (phase % Bytes)));
+        phase++;
+        size--;
+    }
+
+    uint64_t words[3];
+    for (size_t w = 0; w < 3; w++) {
+        uint64_t word = 0;
+        for (size_t b = 0; b < 8; b++) {
+            size_t offset = phase + w * 8 + b;
+            word |= (uint64_t)(uint8_t)(pixel >> (8 * (offset % Bytes))) << (8 * b);
+        }
+        words[w] = word;
+    }
+
+    uint64_t *out = (uint64_t*)dst;
+    size_t count = size / 8;
+    size_t i = 0;
+    for (; i + 3 <= count; i += 3) {
+        store_word(out + i, words[0], nt);
+        store_word(out + i + 1, words[1], nt);
+        store_word(out + i + 2, words[2], nt);
+    }
+    for (size_t w = 0; i < count; i++, w++) {
+        store_word(out + i, words[w], nt);
+    }
+
+    dst += count * 8;
+    phase += count * 8;
+    size -= count * 8;
+    while (size--) {
+        *dst++ = (uint8_t)(pixel >> (8 * (phase % Bytes)));
+        phase++;
+    }
+}
+
+/*
+ * One instance per pixel size and channel layout. Strides, glyph row
+ * sizes and pixel packing are all compile-time constants, so the inner
+ * loops have no format branches.
+ */
+template <size_t Bytes, typename Layout>
+struct Renderer {
+    static constexpr size_t row_bytes = FONT_WIDTH * Bytes;
+    static_assert(row_bytes % 8 == 0, "glyph rows are copied in 64-bit words");
+    static_assert(row_bytes <= FB_GLYPH_ROW_BYTES, "glyph row does not fit the table");
+
+    static inline void store(uint8_t *p, uint32_t pixel) {
+        if constexpr (Bytes == 4) {
+            *(unaligned_u32*)p = pixel;
+        } else if constexpr (Bytes == 3) {
+            p[0] = (uint8_t)pixel;
+            p[1] = (uint8_t)(pixel >> 8);
+            p[2] = (uint8_t)(pixel >> 16);
+        } else {
+            *(unaligned_u16*)p = (uint16_t)pixel;
+        }
+    }
+
+    static uint32_t pack(uint32_t rgb) {
+        return Layout::pack(rgb);
+    }
+
+    static void expand_glyph_rows(fb_glyph_rows rows, uint32_t fg, uint32_t bg) {
+        uint32_t fg_pixel = Layout::pack(fg);
+        uint32_t bg_pixel = Layout::pack(bg);
+        for (size_t bits = 0; bits < 256; bits++) {
+            for (size_t gx = 0; gx < FONT_WIDTH; gx++) {
+                store(&rows[bits][gx * Bytes], (bits & (0x80 >> gx)) ? fg_pixel : bg_pixel);
+            }
+        }
+    }
+
+    static void draw_glyph(uint8_t *dst, uint64_t pitch, const uint8_t *glyph, const fb_glyph_rows rows) {
+        for (size_t gy = 0; gy < FONT_HEIGHT; gy++) {
+            const aligned_u64 *src = (const aligned_u64*)rows[glyph[gy]];
+            unaligned_u64 *out = (unaligned_u64*)dst;
+            for (size_t i = 0; i < row_bytes / 8; i++) {
+                out[i] = src[i];
+            }
+            dst += pitch;
+        }
+    }
+
+    /*
+     * Rows are filled one at a time so the pitch padding is never
+     * touched. Rectangles of at least MEM_NT_THRESHOLD bytes, such as
+     * full-screen clears, bypass the cache when the caller says dst is
+     * not read back.
+     */
+    static void fill_rect(uint8_t *dst, uint64_t pitch, size_t width, size_t height, uint32_t rgb,
+                          bool streaming) {
+        uint32_t pixel = Layout::pack(rgb);
+        size_t row_size = width * Bytes;
+        bool nt = streaming && row_size * height >= MEM_NT_THRESHOLD;
+        for (size_t y = 0; y < height; y++) {
+            fill_span<Bytes>(dst, row_size, pixel, nt);
+            dst += pitch;
+        }
+        if (nt) {
+            __asm__ __volatile__("sfence" ::: "memory");
+        }
+    }
+};
+
+template <size_t Bytes, typename Layout>
+static constexpr fb_renderer make_renderer(const char *name) {
+    return {
+        name,
+        Bytes,
+        Renderer<Bytes, Layout>::pack,
+        Renderer<Bytes, Layout>::expand_glyph_rows,
+        Renderer<Bytes, Layout>::draw_glyph,
+        Renderer<Bytes, Layout>::fill_rect,
+    };
+}
+
+struct fb_format {
+    uint16_t bpp;
+    uint8_t red_size, red_shift;
+    uint8_t green_size, green_shift;
+    uint8_t blue_size, blue_shift;
+    fb_renderer renderer;
+};
+
+static const fb_format known_formats[] = {
+    {32, 8, 16, 8, 8, 8, 0, make_renderer<4, FixedLayout<8, 16, 8, 8, 8, 0>>("xrgb8888")},
+    {32, 8, 0, 8, 8, 8, 16, make_renderer<4, FixedLayout<8, 0, 8, 8, 8, 16>>("xbgr8888")},
+    {24, 8, 16, 8, 8, 8, 0, make_renderer<3, FixedLayout<8, 16, 8, 8, 8, 0>>("rgb888")},
+    {16, 5, 11, 6, 5, 5, 0, make_renderer<2, FixedLayout<5, 11, 6, 5, 5, 0>>("rgb565")},
+    {16, 5, 10, 5, 5, 5, 0, make_renderer<2, FixedLayout<5, 10, 5, 5, 5, 0>>("rgb555")},
+    {15, 5, 10, 5, 5, 5, 0, make_renderer<2, FixedLayout<5, 10, 5, 5, 5, 0>>("rgb555")},
+};
+
+static const fb_renderer generic_renderers[] = {
+    make_renderer<2, RuntimeLayout>("generic16"),
+    make_renderer<3, RuntimeLayout>("generic24"),
+    make_renderer<4, RuntimeLayout>("generic32"),
+};
+
+const struct fb_renderer *fb_select_renderer(const struct limine_framebuffer *fb) {
+    if (!fb || fb->memory_model != LIMINE_FRAMEBUFFER_RGB) {
+        return NULL;
+    }
+
+    for (size_t i = 0; i < sizeof(known_formats) / sizeof(known_formats[0]); i++) {
+        const fb_format *format = &known_formats[i];
+        if (format->bpp == fb->bpp &&
+            format->red_size == fb->red_mask_size && format->red_shift == fb->red_mask_shift &&
+            format->green_size == fb->green_mask_size && format->green_shift == fb->green_mask_shift &&
+            format->blue_size == fb->blue_mask_size && format->blue_shift == fb->blue_mask_shift) {
+            return &format->renderer;
+        }
+    }
+
+    size_t bytes = (fb->bpp + 7) / 8;
+    if (bytes < 2 || bytes > 4) {
+        return NULL;
+    }
+
+    runtime_layout.red_size = fb->red_mask_size;
+    runtime_layout.red_shift = fb->red_mask_shift;
+    runtime_layout.green_size = fb->green_mask_size;
+    runtime_layout.green_shift = fb->green_mask_shift;
+    runtime_layout.blue_size = fb->blue_mask_size;
+    runtime_layout.blue_shift = fb->blue_mask_shift;
+    return &generic_renderers[bytes - 2];
+}
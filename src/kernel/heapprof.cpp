@@ -0,0 +1,235 @@
+#include <kernel/heapprof.h>
+
+#ifdef KMALLOC_PROFILE
+
+#include <kernel/cpu.h>
+#include <kernel/serial.h>
+#include <stdio.h>
+
+struct AllocationRecord
+{
+  uint64_t ptr;
+  uint64_t timestamp;
+  uint64_t size;
+  uint16_t site;
+};
+
+struct SiteRecord
+{
+  uint64_t address;
+  uint64_t live_bytes;
+  uint64_t live_count;
+  uint64_t total_count;
+  uint64_t total_bytes;
+  uint32_t histogram[HEAP_PROFILE_HISTOGRAM_BUCKETS];
+};
+
+static AllocationRecord allocations[HEAP_PROFILE_MAX_ALLOCATIONS];
+static SiteRecord sites[HEAP_PROFILE_MAX_SITES];
+static size_t site_count = 0;
+static size_t live_allocations = 0;
+static uint64_t dropped_allocations = 0;
+static uint64_t dropped_sites = 0;
+static uint64_t leak_marker = 0;
+
+static inline size_t hash_pointer(uint64_t value, size_t capacity)
+{
+  return (size_t)((value >> 3) * 0x9E3779B97F4A7C15ULL >> 32) & (capacity - 1);
+}
+
+static size_t histogram_bucket(size_t size)
+{
+  size_t bucket = 0;
+  size_t s = size ? size - 1 : 0;
+  while (s >= 8 && bucket < HEAP_PROFILE_HISTOGRAM_BUCKETS - 1)
+  {
+    s >>= 1;
+    bucket++;
+  }
+  return bucket;
+}
+
+static SiteRecord *lookup_site(uint64_t address, uint16_t *index)
+{
+  size_t slot = hash_pointer(address, HEAP_PROFILE_MAX_SITES);
+  for (size_t probe = 0; probe < HEAP_PROFILE_MAX_SITES; probe++)
+  {
+    SiteRecord *site = &sites[slot];
+    if (site->address == address)
+    {
+      *index = (uint16_t)slot;
+      return site;
+    }
+    if (site->address == 0)
+    {
+      site->address = address;
+      site_count++;
+      *index = (uint16_t)slot;
+      return site;
+    }
+    slot = (slot + 1) & (HEAP_PROFILE_MAX_SITES - 1);
+  }
+  return nullptr;
+}
+
+static AllocationRecord *find_allocation(uint64_t ptr)
+{
+  size_t slot = hash_pointer(ptr, HEAP_PROFILE_MAX_ALLOCATIONS);
+  for (size_t probe = 0; probe < HEAP_PROFILE_MAX_ALLOCATIONS && allocations[slot].ptr != 0; probe++)
+  {
+    if (allocations[slot].ptr == ptr)
+      return &allocations[slot];
+    slot = (slot + 1) & (HEAP_PROFILE_MAX_ALLOCATIONS - 1);
+  }
+  return nullptr;
+}
+
+// Backward-shift deletion keeps the linear probe chains intact without
+// tombstones, so lookups never degrade as allocations churn.
+static void remove_allocation(AllocationRecord *record)
+{
+  size_t hole = record - allocations;
+  size_t slot = hole;
+  for (;;)
+  {
+    slot = (slot + 1) & (HEAP_PROFILE_MAX_ALLOCATIONS - 1);
+    if (allocations[slot].ptr == 0)
+      break;
+
+    size_t home = hash_pointer(allocations[slot].ptr, HEAP_PROFILE_MAX_ALLOCATIONS);
+    size_t distance_hole = (hole - home) & (HEAP_PROFILE_MAX_ALLOCATIONS - 1);
+    size_t distance_slot = (slot - home) & (HEAP_PROFILE_MAX_ALLOCATIONS - 1);
+    if (distance_hole < distance_slot)
+    {
+      allocations[hole] = allocations[slot];
+      hole = slot;
+    }
+  }
+  allocations[hole].ptr = 0;
+}
+
+void heap_profile_record_alloc(void *ptr, size_t size, void *site_address)
+{
+  if (!ptr)
+    return;
+
+  uint16_t site_index;
+  SiteRecord *site = lookup_site((uint64_t)site_address, &site_index);
+  if (!site)
+  {
+    dropped_sites++;
+    return;
+  }
+
+  site->live_bytes += size;
+  site->live_count++;
+  site->total_count++;
+  site->total_bytes += size;
+  site->histogram[histogram_bucket(size)]++;
+
+  // The table is never allowed to fill up, so every probe chain ends at
+  // an empty slot and lookups for untracked pointers terminate quickly.
+  size_t slot = hash_pointer((uint64_t)ptr, HEAP_PROFILE_MAX_ALLOCATIONS);
+  for (size_t probe = 0; live_allocations < HEAP_PROFILE_MAX_LIVE && probe < HEAP_PROFILE_MAX_ALLOCATIONS / 2; probe++)
+  {
+    AllocationRecord *record = &allocations[slot];
+    if (record->ptr == 0)
+    {
+      record->ptr = (uint64_t)ptr;
+      record->timestamp = rdtsc();
+      record->size = size;
+      record->site = site_index;
+      live_allocations++;
+      return;
+    }
+    slot = (slot + 1) & (HEAP_PROFILE_MAX_ALLOCATIONS - 1);
+  }
+
+  site->live_bytes -= size;
+  site->live_count--;
+  dropped_allocations++;
+}
+
+void heap_profile_record_free(void *ptr)
+{
+  if (!ptr)
+    return;
+
+  AllocationRecord *record = find_allocation((uint64_t)ptr);
+  if (!record)
+    return;
+
+  SiteRecord *site = &sites[record->site];
+  site->live_bytes -= record->size;
+  site->live_count--;
+  remove_allocation(record);
+  live_allocations--;
+}
+
+void heap_profile_mark(void)
+{
+  leak_marker = rdtsc();
+}
+
+void heap_profile_dump(void)
+{
+  char line[160];
+
+  serial_write("=== Heap Profile ===\n");
+  sprintf(line, "sites %zu, dropped allocations %zu, dropped sites %zu\n",
+          site_count, dropped_allocations, dropped_sites);
+  serial_write(line);
+  serial_write("site               live_bytes  live  allocs  total_bytes\n");
+
+  for (size_t i = 0; i < HEAP_PROFILE_MAX_SITES; i++)
+  {
+    SiteRecord *site = &sites[i];
+    if (site->address == 0)
+      continue;
+
+    sprintf(line, "%p  %zu  %zu  %zu  %zu\n",
+            site->address, site->live_bytes, site->live_count,
+            site->total_count, site->total_bytes);
+    serial_write(line);
+
+    serial_write("  sizes:");
+    for (size_t bucket = 0; bucket < HEAP_PROFILE_HISTOGRAM_BUCKETS; bucket++)
+    {
+      if (site->histogram[bucket] == 0)
+        continue;
+      if (bucket == HEAP_PROFILE_HISTOGRAM_BUCKETS - 1)
+        sprintf(line, " >%zu:%zu", (size_t)8 << (bucket - 1), (size_t)site->histogram[bucket]);
+      else
+        sprintf(line, " <=%zu:%zu", (size_t)8 << bucket, (size_t)site->histogram[bucket]);
+      serial_write(line);
+    }
+    serial_write("\n");
+  }
+}
+
+void heap_profile_leak_report(void)
+{
+  char line[128];
+  size_t leaks = 0;
+  size_t leaked_bytes = 0;
+
+  serial_write("=== Heap Leak Report ===\n");
+  for (size_t i = 0; i < HEAP_PROFILE_MAX_ALLOCATIONS; i++)
+  {
+    AllocationRecord *record = &allocations[i];
+    if (record->ptr == 0 || record->timestamp < leak_marker)
+      continue;
+
+    sprintf(line, "%p  %zu bytes  site %p  tsc %zu\n",
+            record->ptr, (size_t)record->size,
+            sites[record->site].address, record->timestamp);
+    serial_write(line);
+    leaks++;
+    leaked_bytes += record->size;
+  }
+
+  sprintf(line, "%zu allocations (%zu bytes) alive since marker\n", leaks, leaked_bytes);
+  serial_write(line);
+}
+
+#endif
@@ -0,0 +1,147 @@
+#include <kernel/interrupt.h>
+#include <kernel/cpu.h>
+#include <stddef.h>
+
+#define PIC1_COMMAND 0x20
+#define PIC1_DATA 0x21
+#define PIC2_COMMAND 0xA0
+#define PIC2_DATA 0xA1
+
+#define PIC_ICW1_INIT 0x11
+#define PIC_ICW4_8086 0x01
+#define PIC_READ_ISR 0x0B
+#define PIC_EOI 0x20
+
+#define IDT_INTERRUPT_GATE 0x8E
+
+struct idt_entry {
+    uint16_t offset_low;
+    uint16_t selector;
+    uint8_t ist;
+    uint8_t flags;
+    uint16_t offset_mid;
+    uint32_t offset_high;
+    uint32_t reserved;
+} __attribute__((packed));
+
+struct idt_pointer {
+    uint16_t limit;
+    uint64_t base;
+} __attribute__((packed));
+
+static_assert(sizeof(idt_entry) == 16, "IDT entries are 16 bytes in long mode");
+
+extern "C" const uint64_t irq_stubs[IRQ_COUNT];
+
+static idt_entry idt[256] __attribute__((aligned(16)));
+static irq_handler_t irq_handlers[IRQ_COUNT];
+static uint16_t irq_masked = 0xFFFF;
+
+static void set_gate(uint8_t vector, uint64_t handler, uint16_t selector) {
+    idt_entry *entry = &idt[vector];
+    entry->offset_low = (uint16_t)handler;
+    entry->selector = selector;
+    entry->ist = 0;
+    entry->flags = IDT_INTERRUPT_GATE;
+    entry->offset_mid = (uint16_t)(handler >> 16);
+    entry->offset_high = (uint32_t)(handler >> 32);
+    entry->reserved = 0;
+}
+
+static void pic_write_masks(void) {
+    outb(PIC1_DATA, (uint8_t)irq_masked);
+    outb(PIC2_DATA, (uint8_t)(irq_masked >> 8));
+}
+
+/* Moves the PICs off the CPU exception vectors, with every line masked. */
+static void pic_remap(void) {
+    outb(PIC1_COMMAND, PIC_ICW1_INIT);
+    io_wait();
+    outb(PIC2_COMMAND, PIC_ICW1_INIT);
+    io_wait();
+    outb(PIC1_DATA, IRQ_BASE);
+    io_wait();
+    outb(PIC2_DATA, IRQ_BASE + 8);
+    io_wait();
+    outb(PIC1_DATA, 1 << IRQ_CASCADE);
+    io_wait();
+    outb(PIC2_DATA, IRQ_CASCADE);
+    io_wait();
+    outb(PIC1_DATA, PIC_ICW4_8086);
+    io_wait();
+    outb(PIC2_DATA, PIC_ICW4_8086);
+    io_wait();
+
+    irq_masked = 0xFFFF;
+    pic_write_masks();
+}
+
+/*
+ * Only the PIC vectors are installed so far; the kernel still has no
+ * exception handlers. Interrupts stay disabled until the caller enables
+ * them.
+ */
+void interrupt_initialize(void) {
+    uint16_t cs;
+    __asm__ __volatile__("mov %%cs, %0" : "=r"(cs));
+
+    for (size_t irq = 0; irq < IRQ_COUNT; irq++) {
+        set_gate(IRQ_BASE + irq, irq_stubs[irq], cs);
+    }
+    pic_remap();
+
+    idt_pointer idtr = {sizeof(idt) - 1, (uint64_t)idt};
+    __asm__ __volatile__("lidt %0" : : "m"(idtr));
+}
+
+void irq_register(uint8_t irq, irq_handler_t handler) {
+    if (irq >= IRQ_COUNT) return;
+    irq_handlers[irq] = handler;
+    irq_unmask(irq);
+}
+
+void irq_mask(uint8_t irq) {
+    if (irq >= IRQ_COUNT) return;
+    uint64_t flags = interrupt_save();
+    irq_masked |= 1u << irq;
+    pic_write_masks();
+    interrupt_restore(flags);
+}
+
+void irq_unmask(uint8_t irq) {
+    if (irq >= IRQ_COUNT) return;
+    uint64_t flags = interrupt_save();
+    irq_masked &= ~(1u << irq);
+    if (irq >= 8) {
+        irq_masked &= ~(1u << IRQ_CASCADE);
+    }
+    pic_write_masks();
+    interrupt_restore(flags);
+}
+
+/* IRQ 7 and 15 are also raised spuriously; only the in-service register tells. */
+static bool irq_spurious(uint64_t irq) {
+    if (irq != 7 && irq != 15) return false;
+
+    uint16_t port = irq == 7 ? PIC1_COMMAND : PIC2_COMMAND;
+    outb(port, PIC_READ_ISR);
+    return (inb(port) & 0x80) == 0;
+}
+
+extern "C" void irq_dispatch(uint64_t irq) {
+    if (irq_spurious(irq)) {
+        if (irq == 15) {
+            outb(PIC1_COMMAND, PIC_EOI);
+        }
+        return;
+    }
+
+    if (irq_handlers[irq]) {
+        irq_handlers[irq]();
+    }
+
+    if (irq >= 8) {
+        outb(PIC2_COMMAND, PIC_EOI);
+    }
+    outb(PIC1_COMMAND, PIC_EOI);
+}
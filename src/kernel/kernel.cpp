@@ -1,21 +1,62 @@
 #include <stdio.h>
+#include <string.h>
 
 #include <kernel/serial.h>
 #include <kernel/terminal.h>
 #include <kernel/memory.h>
+#include <kernel/bench.h>
+#include <kernel/klog.h>
+#include <kernel/console.h>
+#include <kernel/interrupt.h>
+#include <kernel/debugcon.h>
+#include <kernel/clock.h>
+#include <kernel/bootprof.h>
 #include <limine.h>
 
 
 extern "C" void kernel_main(void) {
+	bootprof_initialize();
+	boot_phase("string_initialize");
+	string_initialize();
+	boot_phase("klog_initialize");
+	klog_initialize();
+	boot_phase("serial_initialize");
 	serial_initialize();
+	boot_phase("terminal_initialize");
 	terminal_initialize();
+	boot_phase("console_initialize");
+	console_initialize();
+	boot_phase("interrupt_initialize");
+	interrupt_initialize();
+	serial_enable_interrupts();
+	interrupts_enable();
 	
+	boot_phase("getMemoryInfo");
 	getMemoryInfo();
 
+	boot_phase("pmm_initialize");
 	PhysicalMemoryManager* pm = pmm();
 	pm->initialize();
+	boot_phase("vmm_initialize");
 	VirtualMemoryManager* vm = vmm();
 	vm->initialize();	
+	boot_phase("terminal_enable_back_buffer");
+	terminal_enable_back_buffer();
+	boot_phase("debugcon_initialize");
+	debugcon_initialize();
+	boot_phase("clock_initialize");
+	clock_initialize();
+	boot_phase("console_flush");
+	klog_flush();
+	console_drain();
+	bootprof_finish();
+
+#ifdef KERNEL_BENCH
+	bench_memory();
+	bench_format();
+#endif
 	
-	for (;;);
+	for (;;) {
+		console_drain();
+	}
 }
\ No newline at end of file
@@ -0,0 +1,122 @@
+#include <kernel/kfmt.h>
+#include <sys/format.h>
+
+namespace kfmt
+{
+
+static void write_fill(Writer &writer, char fill, size_t count)
+{
+  char pad[16];
+  for (size_t i = 0; i < sizeof(pad); i++)
+  {
+    pad[i] = fill;
+  }
+  while (count > 0)
+  {
+    size_t chunk = count < sizeof(pad) ? count : sizeof(pad);
+    writer.write(pad, chunk);
+    count -= chunk;
+  }
+}
+
+// Zero fill goes between the sign or 0x prefix and the digits; any other
+// fill goes outside the whole field.
+static void write_field(Writer &writer, Spec spec, const char *prefix, size_t prefix_length,
+                        const char *digits, size_t digit_count)
+{
+  size_t total = prefix_length + digit_count;
+  size_t padding = spec.width > total ? spec.width - total : 0;
+
+  if (spec.left)
+  {
+    writer.write(prefix, prefix_length);
+    writer.write(digits, digit_count);
+    write_fill(writer, spec.fill == '0' ? ' ' : spec.fill, padding);
+  }
+  else if (spec.fill == '0')
+  {
+    writer.write(prefix, prefix_length);
+    write_fill(writer, '0', padding);
+    writer.write(digits, digit_count);
+  }
+  else
+  {
+    write_fill(writer, spec.fill, padding);
+    writer.write(prefix, prefix_length);
+    writer.write(digits, digit_count);
+  }
+}
+
+void write_unsigned(Writer &writer, uint64_t value, Spec spec)
+{
+  char buffer[20];
+  char *end = buffer + sizeof(buffer);
+  char *start = __format_decimal(end, value);
+  write_field(writer, spec, "", 0, start, end - start);
+}
+
+void write_signed(Writer &writer, int64_t value, Spec spec)
+{
+  char buffer[20];
+  char *end = buffer + sizeof(buffer);
+  uint64_t magnitude = value < 0 ? -(uint64_t)value : (uint64_t)value;
+  char *start = __format_decimal(end, magnitude);
+  write_field(writer, spec, "-", value < 0 ? 1 : 0, start, end - start);
+}
+
+void write_hex(Writer &writer, uint64_t value, Spec spec)
+{
+  char buffer[16];
+  char *end = buffer + sizeof(buffer);
+  char *start = __format_hex(end, value, spec.type == Type::HexUpper ? __hex_upper : __hex_lower);
+  write_field(writer, spec, "", 0, start, end - start);
+}
+
+void write_pointer(Writer &writer, uint64_t value, Spec spec)
+{
+  char buffer[16];
+  for (size_t i = 0; i < sizeof(buffer); i++)
+  {
+    buffer[sizeof(buffer) - 1 - i] = __hex_upper[value & 0xF];
+    value >>= 4;
+  }
+  write_field(writer, spec, "0x", 2, buffer, sizeof(buffer));
+}
+
+void write_string(Writer &writer, const char *value, Spec spec)
+{
+  if (!value)
+    value = "(null)";
+  size_t length = 0;
+  while (value[length])
+  {
+    length++;
+  }
+  if (spec.fill == '0')
+    spec.fill = ' ';
+  write_field(writer, spec, "", 0, value, length);
+}
+
+void write_char(Writer &writer, char value, Spec spec)
+{
+  if (spec.fill == '0')
+    spec.fill = ' ';
+  write_field(writer, spec, "", 0, &value, 1);
+}
+
+void buffer_write(void *ctx, const char *data, size_t size)
+{
+  BufferTarget *target = (BufferTarget *)ctx;
+  if (target->length + 1 < target->size)
+  {
+    size_t room = target->size - 1 - target->length;
+    size_t count = size < room ? size : room;
+    for (size_t i = 0; i < count; i++)
+    {
+      target->buffer[target->length + i] = data[i];
+    }
+  }
+  target->length += size;
+}
+
+} // namespace kfmt
@@ -0,0 +1,189 @@
+#include <stdio.h>
+#include <string.h>
+
+#include <kernel/klog.h>
+#include <kernel/cpu.h>
+
+struct klog_ring
+{
+  alignas(64) uint64_t head;
+  alignas(64) uint64_t tail;
+  uint64_t lost;
+  klog_record records[KLOG_RING_RECORDS];
+};
+
+static_assert((KLOG_RING_RECORDS & (KLOG_RING_RECORDS - 1)) == 0,
+              "KLOG_RING_RECORDS must be a power of two");
+static_assert(sizeof(klog_record) == 64, "klog_record should fill one cache line");
+
+static klog_ring rings[KLOG_MAX_CPUS];
+static bool klog_has_rdtscp = false;
+static uint64_t klog_dropped = 0;
+static int klog_draining = 0;
+
+static inline uint64_t klog_timestamp(uint32_t *cpu)
+{
+  if (klog_has_rdtscp)
+    return rdtscp(cpu);
+  *cpu = 0;
+  return rdtsc();
+}
+
+/*
+ * The CPU index is kept in IA32_TSC_AUX so that a single rdtscp yields
+ * both the timestamp and the ring to log into. Only the bootstrap
+ * processor runs kernel code so far; secondary CPUs have to program
+ * their own index here when they are brought up.
+ */
+void klog_initialize(void)
+{
+  uint32_t eax, ebx, ecx, edx;
+  cpuid(0x80000000, 0, &eax, &ebx, &ecx, &edx);
+  if (eax >= 0x80000001)
+  {
+    cpuid(0x80000001, 0, &eax, &ebx, &ecx, &edx);
+    klog_has_rdtscp = (edx & CPUID_80000001_EDX_RDTSCP) != 0;
+  }
+  if (klog_has_rdtscp)
+    wrmsr(MSR_TSC_AUX, 0);
+}
+
+void klog_write(const klog_site *site, const uint64_t *args)
+{
+  uint32_t cpu;
+  uint64_t timestamp = klog_timestamp(&cpu);
+  if (cpu >= KLOG_MAX_CPUS)
+  {
+    __atomic_fetch_add(&klog_dropped, 1, __ATOMIC_RELAXED);
+    return;
+  }
+
+  klog_ring *ring = &rings[cpu];
+  uint64_t index = 1;
+  __asm__ __volatile__("xaddq %0, %1" : "+r"(index), "+m"(ring->head) : : "memory");
+
+  klog_record *record = &ring->records[index & (KLOG_RING_RECORDS - 1)];
+  __atomic_store_n(&record->sequence, 0, __ATOMIC_RELAXED);
+  __atomic_signal_fence(__ATOMIC_SEQ_CST);
+  record->site = site;
+  record->timestamp = timestamp;
+  for (size_t i = 0; i < KLOG_MAX_ARGS; i++)
+  {
+    record->args[i] = args[i];
+  }
+  __atomic_store_n(&record->sequence, index + 1, __ATOMIC_RELEASE);
+}
+
+/*
+ * Copies the next committed record of a ring into *out. Returns false if
+ * the ring is empty or its next record is still being written. Records
+ * that were overwritten before they could be read are skipped and added
+ * to the ring's lost count.
+ */
+static bool klog_peek(klog_ring *ring, klog_record *out)
+{
+  for (;;)
+  {
+    uint64_t head = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+    if (ring->tail == head)
+      return false;
+    if (head - ring->tail > KLOG_RING_RECORDS)
+    {
+      ring->lost += head - KLOG_RING_RECORDS - ring->tail;
+      ring->tail = head - KLOG_RING_RECORDS;
+    }
+
+    klog_record *record = &ring->records[ring->tail & (KLOG_RING_RECORDS - 1)];
+    uint64_t sequence = __atomic_load_n(&record->sequence, __ATOMIC_ACQUIRE);
+    if (sequence == ring->tail + 1)
+    {
+      memcpy(out, record, sizeof(klog_record));
+      __atomic_thread_fence(__ATOMIC_ACQUIRE);
+      if (__atomic_load_n(&record->sequence, __ATOMIC_RELAXED) == sequence)
+        return true;
+    }
+    else if (sequence <= ring->tail)
+    {
+      return false;
+    }
+
+    ring->lost++;
+    ring->tail++;
+  }
+}
+
+static void klog_report_lost(printf_callback_t callback, void *ctx, size_t cpu, uint64_t lost)
+{
+  kfmt::format_to<"klog: cpu{} lost {} records\n">(callback, ctx, cpu, lost);
+}
+
+size_t klog_drain(printf_callback_t callback, void *ctx)
+{
+  if (__atomic_exchange_n(&klog_draining, 1, __ATOMIC_ACQUIRE))
+    return 0;
+
+  size_t drained = 0;
+  klog_record pending[KLOG_MAX_CPUS];
+  bool ready[KLOG_MAX_CPUS];
+  for (size_t cpu = 0; cpu < KLOG_MAX_CPUS; cpu++)
+  {
+    ready[cpu] = klog_peek(&rings[cpu], &pending[cpu]);
+  }
+
+  for (;;)
+  {
+    size_t next = KLOG_MAX_CPUS;
+    for (size_t cpu = 0; cpu < KLOG_MAX_CPUS; cpu++)
+    {
+      if (ready[cpu] && (next == KLOG_MAX_CPUS || pending[cpu].timestamp < pending[next].timestamp))
+        next = cpu;
+    }
+    if (next == KLOG_MAX_CPUS)
+      break;
+
+    klog_ring *ring = &rings[next];
+    if (ring->lost)
+    {
+      klog_report_lost(callback, ctx, next, ring->lost);
+      ring->lost = 0;
+    }
+
+    klog_record *record = &pending[next];
+    kfmt::format_to<"[{}:{:>14}] ">(callback, ctx, next, record->timestamp);
+    record->site->decode(callback, ctx, record->args);
+    ring->tail++;
+    drained++;
+
+    ready[next] = klog_peek(ring, &pending[next]);
+  }
+
+  for (size_t cpu = 0; cpu < KLOG_MAX_CPUS; cpu++)
+  {
+    if (rings[cpu].lost)
+    {
+      klog_report_lost(callback, ctx, cpu, rings[cpu].lost);
+      rings[cpu].lost = 0;
+    }
+  }
+
+  uint64_t dropped = __atomic_exchange_n(&klog_dropped, 0, __ATOMIC_RELAXED);
+  if (dropped)
+    kfmt::format_to<"klog: dropped {} records from unknown CPUs\n">(callback, ctx, dropped);
+
+  __atomic_store_n(&klog_draining, 0, __ATOMIC_RELEASE);
+  return drained;
+}
+
+size_t klog_flush(void)
+{
+  return klog_drain(console_write, nullptr);
+}
+
+void klog_discard(void)
+{
+  for (size_t cpu = 0; cpu < KLOG_MAX_CPUS; cpu++)
+  {
+    rings[cpu].tail = __atomic_load_n(&rings[cpu].head, __ATOMIC_ACQUIRE);
+    rings[cpu].lost = 0;
+  }
+}
@@ -3,6 +3,9 @@
 #include <limine.h>
 
 #include <kernel/memory.h>
+#include <kernel/heapprof.h>
+#include <kernel/kfmt.h>
+#include <kernel/klog.h>
 #include <kernel/terminal.h>
 
 static volatile struct limine_memmap_request memmap_request = {
@@ -59,8 +62,8 @@ void getMemoryInfo()
     return;
   }
 
-  printf("Memory map revision: %d\n", memmap->revision);
-  printf("Total memory regions: %d\n\n", memmap->entry_count);
+  kfmt::print<"Memory map revision: {}\n">(memmap->revision);
+  kfmt::print<"Total memory regions: {}\n\n">(memmap->entry_count);
 
   printf("Memory Regions:\n");
   printf("No.  Start Address    End Address      Size             Type\n");
@@ -98,8 +101,8 @@ void getMemoryInfo()
       size_unit = "KB";
     }
 
-    printf(" %d  %p  %p  %ul %s  %s\n",
-           i, entry->base, end_address, size_value, size_unit, type_str);
+    kfmt::print<" {}  {:p}  {:p}  {} {}  {}\n">(
+        i, entry->base, end_address, size_value, size_unit, type_str);
 
     total_memory += entry->length;
 
@@ -135,10 +138,10 @@ void getMemoryInfo()
   printf("\nMemory Statistics:\n");
   printf(" Type                      Size          Percentage\n");
 
-#define PRINT_MEM_STAT(name, value)   \
-  printf(" %s   %d MB       %d%%\n",  \
-         name, value / (1024 * 1024), \
-         total_memory > 0 ? (value / total_memory * 100) : 0)
+#define PRINT_MEM_STAT(name, value)                     \
+  kfmt::print<" {}   {} MB       {}%\n">(                \
+      name, value / (1024 * 1024),                      \
+      total_memory > 0 ? (value * 100 / total_memory) : 0)
 
   PRINT_MEM_STAT("Total Memory", total_memory);
   PRINT_MEM_STAT("Usable Memory", usable_memory);
@@ -159,9 +162,9 @@ void getMemoryInfo()
     if (entry->type == LIMINE_MEMMAP_USABLE)
     { // USABLE
       uint64_t end_address = entry->base + entry->length - 1;
-      printf("  %p   %p   %d MB\n",
-             entry->base, end_address,
-             entry->length / (1024 * 1024));
+      kfmt::print<"  {:p}   {:p}   {} MB\n">(
+          entry->base, end_address,
+          entry->length / (1024 * 1024));
       usable_count++;
     }
   }
@@ -181,7 +184,7 @@ void PhysicalMemoryManager::initialize()
 {
   struct limine_memmap_response *memmap = memmap_request.response;
 
-  printf("Initializing Physical Memory Manager...\n");
+  klog<"Initializing Physical Memory Manager...\n">();
 
   uint64_t highest_addr = 0;
   uint64_t bitmap_addr = 0;
@@ -244,15 +247,15 @@ void PhysicalMemoryManager::initialize()
     usedBlocks++;
   }
 
-  printf("PMM initialized successfully\n");
-  printf("Memory Map:\n");
-  printf("  Highest physical address: %p\n", highest_addr);
-  printf("  Total usable memory: %d MB\n", usable_memory / 1024 / 1024);
-  printf("  Total blocks: %d\n", totalBlocks);
-  printf("  Usable blocks: %d\n", usableBlocks);
-  printf("  Bitmap size: %d bytes\n", bitmapSize);
-  printf("  Bitmap address: %p\n", bitmap_addr);
-  printf("  Free memory: %u MB\n", getFreeMemory() / 1024 / 1024);
+  klog<"PMM initialized successfully\n">();
+  klog<"Memory Map:\n">();
+  klog<"  Highest physical address: {:p}\n">(highest_addr);
+  klog<"  Total usable memory: {} MB\n">(usable_memory / 1024 / 1024);
+  klog<"  Total blocks: {}\n">(totalBlocks);
+  klog<"  Usable blocks: {}\n">(usableBlocks);
+  klog<"  Bitmap size: {} bytes\n">(bitmapSize);
+  klog<"  Bitmap address: {:p}\n">(bitmap_addr);
+  klog<"  Free memory: {} MB\n">(getFreeMemory() / 1024 / 1024);
 }
 
 uint64_t PhysicalMemoryManager::alloc()
@@ -262,7 +265,12 @@ uint64_t PhysicalMemoryManager::alloc()
 
 uint64_t PhysicalMemoryManager::allocBlocks(size_t blocks)
 {
-  if (blocks == 0)
+  return allocBlocksAligned(blocks, 1);
+}
+
+uint64_t PhysicalMemoryManager::allocBlocksAligned(size_t blocks, size_t align)
+{
+  if (blocks == 0 || align == 0)
     return NULL;
 
   size_t start_block = 0;
@@ -274,6 +282,8 @@ uint64_t PhysicalMemoryManager::allocBlocks(size_t blocks)
     {
       if (consecutive_blocks == 0)
       {
+        if (i % align != 0)
+          continue;
         start_block = i;
       }
       consecutive_blocks++;
@@ -358,37 +368,47 @@ VirtualMemoryManager *VirtualMemoryManager::getInstance()
   return &instance;
 }
 
+PageTable *VirtualMemoryManager::get_table(PageTableEntry *entry)
+{
+  return (PageTable *)physicalToVirtual(entry->get_pfn() << 12);
+}
+
 PageTable *VirtualMemoryManager::get_or_create_table(PageTableEntry *entry, uint64_t flags)
 {
   if (entry->is_present())
   {
-    return (PageTable *)(entry->get_pfn());
+    return get_table(entry);
   }
 
-  void *physical_addr = (void *)pmm()->alloc();
-  if (!physical_addr)
+  PageTable *table = pageTableCache.alloc();
+  if (!table)
   {
     return nullptr;
   }
 
-  PageTable *table = (PageTable *)physical_addr;
-  table->clear();
-
-  entry->set_pfn(reinterpret_cast<uint64_t>(physical_addr), flags | PRESENT | WRITABLE);
+  // Caching and size bits describe the final page, not the tables above it.
+  entry->set_pfn(virtualToPhysical(table) >> 12, (flags & USER_ACCESS) | PRESENT | WRITABLE);
   return table;
 }
 
 void VirtualMemoryManager::initialize()
 {
-  printf("VMM: Initializing virtual memory...\n");
+  klog<"VMM: Initializing virtual memory...\n">();
 
   uint64_t cr3;
   asm volatile("mov %%cr3, %0" : "=r"(cr3));
 
-  pml4_table = clonePageTable((PageTable *)(cr3 & ~0xFFF));
-  asm volatile("mov %0, %%cr3" ::"r"(pml4_table));
+  PageTable *boot_pml4 = (PageTable *)physicalToVirtual(cr3 & PTE_FRAME_MASK);
+  pml4_table = clonePageTable(boot_pml4);
+  if (!pml4_table)
+  {
+    printf("VMM: Out of memory while cloning the boot page tables\n");
+    pml4_table = boot_pml4;
+    return;
+  }
+  asm volatile("mov %0, %%cr3" ::"r"(virtualToPhysical(pml4_table)));
 
-  printf("VMM: Virtual memory initialized\n");
+  klog<"VMM: Virtual memory initialized\n">();
 }
 
 void VirtualMemoryManager::initialize_kernel_mappings()
@@ -405,7 +425,7 @@ void VirtualMemoryManager::initialize_kernel_mappings()
       uint64_t physical_base = entry->base;
       uint64_t virtual_base = 0xFFFFFFFF80000000 + (physical_base & 0xFFFFFFFF);
       uint64_t pages = (entry->length + PAGE_SIZE - 1) / PAGE_SIZE;
-      printf("VMM: Mapping kernel region: %p - %p to %p - %p\n", physical_base, physical_base + entry->length, virtual_base, virtual_base + entry->length);
+      klog<"VMM: Mapping kernel region: {:p} - {:p} to {:p} - {:p}\n">(physical_base, physical_base + entry->length, virtual_base, virtual_base + entry->length);
 
       for (uint64_t j = 0; j < pages; j++)
       {
@@ -436,7 +456,7 @@ void VirtualMemoryManager::initialize_kernel_mappings()
       map_framebuffer(response->framebuffers[i]);
     }
   }
-  printf("VMM: Kernel mappings created\n");
+  klog<"VMM: Kernel mappings created\n">();
 }
 
 void VirtualMemoryManager::map_framebuffer(struct limine_framebuffer *fb)
@@ -455,42 +475,35 @@ void VirtualMemoryManager::map_framebuffer(struct limine_framebuffer *fb)
     map_page(addr, addr, PRESENT | WRITABLE | NO_EXECUTE);
   }
 
-  printf("VMM: Framebuffer mapped: %p - %p\n",
-         fb_start, fb_end);
+  klog<"VMM: Framebuffer mapped: {:p} - {:p}\n">(fb_start, fb_end);
 }
 
 void VirtualMemoryManager::initialize_heap()
 {
   const size_t heap_size = 16 * 1024 * 1024;
-  void *heap_physical = physicalToVirtual(pmm()->allocBlocks(heap_size / PAGE_SIZE));
+  void *heap = vmalloc(heap_size);
 
-  if (!heap_physical)
+  if (!heap)
   {
     printf("VMM: Failed to allocate kernel heap!\n");
     return;
   }
 
-  uint64_t heap_virtual = 0xFFFFFFFF82000000;
-
-  printf("VMM: Kernel heap created at %p\n", heap_virtual);
+  uint64_t heap_virtual = reinterpret_cast<uint64_t>(heap);
 
-  for (size_t i = 0; i < heap_size; i += PAGE_SIZE)
-  {
-    map_page(heap_virtual + i, reinterpret_cast<uint64_t>(heap_physical) + i,
-             PRESENT | WRITABLE | NO_EXECUTE);
-  }
+  klog<"VMM: Kernel heap created at {:p}\n">(heap_virtual);
 
-  HeapBlock *heapBlock = (HeapBlock *)heap_physical;
+  HeapBlock *heapBlock = (HeapBlock *)heap;
   heapBlock->size = heap_size - sizeof(HeapBlock);
   heapBlock->used = false;
   heapBlock->next = nullptr;
   heapBlock->prev = nullptr;
-  heap_start = (HeapBlock *)heap_virtual;
+  heap_start = heapBlock;
 
   heap_current = heap_virtual + sizeof(HeapBlock);
   heap_end = heap_virtual + heap_size;
 
-  printf("VMM: Kernel heap initialized at %p\n", heap_virtual);
+  klog<"VMM: Kernel heap initialized at {:p}\n">(heap_virtual);
 }
 
 void VirtualMemoryManager::map_page(uint64_t virtual_addr, uint64_t physical_addr, uint64_t flags)
@@ -516,12 +529,12 @@ void VirtualMemoryManager::map_page(uint64_t virtual_addr, uint64_t physical_add
     return;
 
   PageTableEntry *pt_entry = pt_table->get_entry(pt_index);
-  pt_entry->set_pfn(physical_addr, flags);
+  pt_entry->set_pfn(physical_addr >> 12, flags);
 
   invalidate_tlb(virtual_addr);
 }
 
-void VirtualMemoryManager::unmap_page(uint64_t virtual_addr)
+bool VirtualMemoryManager::clear_page(uint64_t virtual_addr, bool release)
 {
   size_t pml4_index = (virtual_addr >> 39) & 0x1FF;
   size_t pdp_index = (virtual_addr >> 30) & 0x1FF;
@@ -530,29 +543,49 @@ void VirtualMemoryManager::unmap_page(uint64_t virtual_addr)
 
   PageTableEntry *pml4_entry = pml4_table->get_entry(pml4_index);
   if (!pml4_entry->is_present())
-    return;
+    return false;
 
-  PageTable *pdp_table = (PageTable *)(pml4_entry->get_pfn());
+  PageTable *pdp_table = get_table(pml4_entry);
   PageTableEntry *pdp_entry = pdp_table->get_entry(pdp_index);
   if (!pdp_entry->is_present())
-    return;
+    return false;
 
-  PageTable *pd_table = (PageTable *)(pdp_entry->get_pfn());
+  PageTable *pd_table = get_table(pdp_entry);
   PageTableEntry *pd_entry = pd_table->get_entry(pd_index);
   if (!pd_entry->is_present())
-    return;
+    return false;
 
-  PageTable *pt_table = (PageTable *)(pd_entry->get_pfn());
+  PageTable *pt_table = get_table(pd_entry);
   PageTableEntry *pt_entry = pt_table->get_entry(pt_index);
 
   if (pt_entry->is_present())
   {
-    pmm()->free(reinterpret_cast<void *>(pt_entry->get_pfn()));
+    if (release)
+      pmm()->free(reinterpret_cast<void *>(pt_entry->get_pfn() << 12));
     pt_entry->value = 0;
+    return true;
+  }
+
+  return false;
+}
+
+void VirtualMemoryManager::unmap_page(uint64_t virtual_addr)
+{
+  if (clear_page(virtual_addr))
+  {
     invalidate_tlb(virtual_addr);
   }
 }
 
+void VirtualMemoryManager::unmap_range(uint64_t virtual_addr, size_t pages)
+{
+  for (size_t i = 0; i < pages; i++)
+  {
+    clear_page(virtual_addr + i * PAGE_SIZE);
+  }
+  invalidate_tlb_range(virtual_addr, pages);
+}
+
 uint64_t VirtualMemoryManager::get_physical_address(uint64_t virtual_addr)
 {
   size_t pml4_index = (virtual_addr >> 39) & 0x1FF;
@@ -564,22 +597,22 @@ uint64_t VirtualMemoryManager::get_physical_address(uint64_t virtual_addr)
   if (!pml4_entry->is_present())
     return 0;
 
-  PageTable *pdp_table = (PageTable *)(pml4_entry->get_pfn());
+  PageTable *pdp_table = get_table(pml4_entry);
   PageTableEntry *pdp_entry = pdp_table->get_entry(pdp_index);
   if (!pdp_entry->is_present())
     return 0;
 
-  PageTable *pd_table = (PageTable *)(pdp_entry->get_pfn());
+  PageTable *pd_table = get_table(pdp_entry);
   PageTableEntry *pd_entry = pd_table->get_entry(pd_index);
   if (!pd_entry->is_present())
     return 0;
 
-  PageTable *pt_table = (PageTable *)(pd_entry->get_pfn());
+  PageTable *pt_table = get_table(pd_entry);
   PageTableEntry *pt_entry = pt_table->get_entry(pt_index);
 
   if (pt_entry->is_present())
   {
-    return pt_entry->get_pfn() + (virtual_addr & 0xFFF);
+    return (pt_entry->get_pfn() << 12) + (virtual_addr & 0xFFF);
   }
 
   return 0;
@@ -595,6 +628,27 @@ void VirtualMemoryManager::invalidate_tlb(uint64_t virtual_addr)
   asm volatile("invlpg (%0)" ::"r"(virtual_addr) : "memory");
 }
 
+void VirtualMemoryManager::invalidate_tlb_range(uint64_t virtual_addr, size_t pages)
+{
+  if (pages > TLB_FLUSH_ALL_THRESHOLD)
+  {
+    flush_tlb();
+    return;
+  }
+
+  for (size_t i = 0; i < pages; i++)
+  {
+    invalidate_tlb(virtual_addr + i * PAGE_SIZE);
+  }
+}
+
+void VirtualMemoryManager::flush_tlb()
+{
+  uint64_t cr3;
+  asm volatile("mov %%cr3, %0" : "=r"(cr3));
+  asm volatile("mov %0, %%cr3" ::"r"(cr3) : "memory");
+}
+
 VirtualMemoryManager::HeapBlock *VirtualMemoryManager::find_free_block(size_t size)
 {
   HeapBlock *current = heap_start;
@@ -610,17 +664,8 @@ VirtualMemoryManager::HeapBlock *VirtualMemoryManager::find_free_block(size_t si
   return nullptr;
 }
 
-void *VirtualMemoryManager::kmalloc(size_t size)
+void VirtualMemoryManager::split_block(HeapBlock *block, size_t size)
 {
-  size = (size + 7) & ~7;
-
-  HeapBlock *block = find_free_block(size);
-  if (!block)
-  {
-    printf("VMM: Out of heap memory!\n");
-    return nullptr;
-  }
-
   if (block->size > size + sizeof(HeapBlock) + 8)
   {
     HeapBlock *new_block = (HeapBlock *)((uint8_t *)block + sizeof(HeapBlock) + size);
@@ -637,12 +682,166 @@ void *VirtualMemoryManager::kmalloc(size_t size)
     block->size = size;
     block->next = new_block;
   }
+}
+
+void *VirtualMemoryManager::kmalloc(size_t size)
+{
+  void *ptr = allocate_block(size);
+  HEAP_PROFILE_ALLOC(ptr, size);
+  return ptr;
+}
+
+void *VirtualMemoryManager::allocate_block(size_t size)
+{
+  size = (size + 7) & ~7;
+
+  HeapBlock *block = find_free_block(size);
+  if (!block)
+  {
+    printf("VMM: Out of heap memory!\n");
+    return nullptr;
+  }
+
+  split_block(block, size);
 
   block->used = true;
   return (void *)((uint8_t *)block + sizeof(HeapBlock));
 }
 
+void *VirtualMemoryManager::kmalloc_aligned(size_t size, size_t align)
+{
+  if (align <= 8)
+  {
+    void *ptr = allocate_block(size);
+    HEAP_PROFILE_ALLOC(ptr, size);
+    return ptr;
+  }
+
+  if (align & (align - 1))
+  {
+    printf("VMM: kmalloc_aligned: alignment %lu is not a power of two\n", align);
+    return nullptr;
+  }
+
+  size = (size + 7) & ~7;
+
+  for (HeapBlock *current = heap_start; current; current = current->next)
+  {
+    if (current->used)
+      continue;
+
+    uint64_t start = (uint64_t)current + sizeof(HeapBlock);
+    uint64_t end = start + current->size;
+    uint64_t payload = (start + align - 1) & ~(align - 1);
+
+    // The slack in front of the aligned payload must be able to hold a
+    // free block of its own, otherwise it would be lost to the heap.
+    while (payload != start && payload - start < sizeof(HeapBlock) + 8)
+    {
+      payload += align;
+    }
+
+    if (payload + size > end)
+      continue;
+
+    HeapBlock *block = current;
+    if (payload != start)
+    {
+      block = (HeapBlock *)(payload - sizeof(HeapBlock));
+      block->size = end - payload;
+      block->used = false;
+      block->next = current->next;
+      block->prev = current;
+
+      if (current->next)
+      {
+        current->next->prev = block;
+      }
+
+      current->size = (uint64_t)block - start;
+      current->next = block;
+    }
+
+    split_block(block, size);
+
+    block->used = true;
+    HEAP_PROFILE_ALLOC((void *)payload, size);
+    return (void *)payload;
+  }
+
+  printf("VMM: Out of heap memory!\n");
+  return nullptr;
+}
+
+void *VirtualMemoryManager::krealloc(void *ptr, size_t size)
+{
+  if (!ptr)
+  {
+    ptr = allocate_block(size);
+    HEAP_PROFILE_ALLOC(ptr, size);
+    return ptr;
+  }
+
+  if (size == 0)
+  {
+    HEAP_PROFILE_FREE(ptr);
+    release_block(ptr);
+    return nullptr;
+  }
+
+  size = (size + 7) & ~7;
+  HeapBlock *block = (HeapBlock *)((uint8_t *)ptr - sizeof(HeapBlock));
+
+  if (block->size < size)
+  {
+    HeapBlock *next = block->next;
+    if (!next || next->used || block->size + sizeof(HeapBlock) + next->size < size)
+    {
+      void *new_ptr = allocate_block(size);
+      if (!new_ptr)
+        return nullptr;
+
+      memcpy(new_ptr, ptr, block->size);
+      HEAP_PROFILE_FREE(ptr);
+      release_block(ptr);
+      HEAP_PROFILE_ALLOC(new_ptr, size);
+      return new_ptr;
+    }
+
+    block->size += sizeof(HeapBlock) + next->size;
+    block->next = next->next;
+    if (block->next)
+    {
+      block->next->prev = block;
+    }
+  }
+
+  split_block(block, size);
+  if (block->next && !block->next->used)
+  {
+    merge_free_blocks();
+  }
+  HEAP_PROFILE_FREE(ptr);
+  HEAP_PROFILE_ALLOC(ptr, size);
+  return ptr;
+}
+
+size_t VirtualMemoryManager::kmalloc_usable_size(void *ptr)
+{
+  if (!ptr)
+    return 0;
+
+  HeapBlock *block = (HeapBlock *)((uint8_t *)ptr - sizeof(HeapBlock));
+  return block->size;
+}
+
 void VirtualMemoryManager::kfree(void *ptr)
+{
+  HEAP_PROFILE_FREE(ptr);
+  release_block(ptr);
+}
+
+void VirtualMemoryManager::release_block(void *ptr)
 {
   if (!ptr)
     return;
@@ -676,13 +875,253 @@ void VirtualMemoryManager::merge_free_blocks()
   }
 }
 
+// Areas are kept sorted by address with an unmapped guard page after
+// each one, so an overrun faults instead of running into a neighbour.
+VirtualMemoryManager::VmArea **VirtualMemoryManager::find_vm_gap(size_t pages, uint64_t *start)
+{
+  uint64_t address = VMALLOC_START;
+  VmArea **link = &vmalloc_areas;
+  while (*link && address + (pages + 1) * PAGE_SIZE > (*link)->start)
+  {
+    address = (*link)->start + ((*link)->pages + 1) * PAGE_SIZE;
+    link = &(*link)->next;
+  }
+
+  if (address + (pages + 1) * PAGE_SIZE > VMALLOC_END)
+    return nullptr;
+
+  *start = address;
+  return link;
+}
+
+VirtualMemoryManager::VmArea **VirtualMemoryManager::find_vm_area(uint64_t start)
+{
+  VmArea **link = &vmalloc_areas;
+  while (*link && (*link)->start != start)
+  {
+    link = &(*link)->next;
+  }
+  return *link ? link : nullptr;
+}
+
+void *VirtualMemoryManager::vmalloc(size_t size)
+{
+  if (size == 0)
+    return nullptr;
+
+  size_t pages = (size + PAGE_SIZE - 1) / PAGE_SIZE;
+
+  VmArea *area = vmAreaCache.alloc();
+  if (!area)
+    return nullptr;
+
+  uint64_t start;
+  VmArea **link = find_vm_gap(pages, &start);
+  if (!link)
+  {
+    printf("VMM: vmalloc: Out of virtual address space for %lu pages\n", pages);
+    vmAreaCache.free(area);
+    return nullptr;
+  }
+
+  for (size_t i = 0; i < pages; i++)
+  {
+    uint64_t physical_addr = pmm()->alloc();
+    if (!physical_addr)
+    {
+      printf("VMM: vmalloc: Out of memory after %lu of %lu pages\n", i, pages);
+      unmap_range(start, i);
+      vmAreaCache.free(area);
+      return nullptr;
+    }
+    map_page(start + i * PAGE_SIZE, physical_addr, PRESENT | WRITABLE | NO_EXECUTE);
+  }
+
+  area->start = start;
+  area->pages = pages;
+  area->io = false;
+  area->next = *link;
+  *link = area;
+
+  return (void *)start;
+}
+
+void VirtualMemoryManager::vfree(void *ptr)
+{
+  if (!ptr)
+    return;
+
+  VmArea **link = find_vm_area((uint64_t)ptr);
+  if (!link || (*link)->io)
+  {
+    printf("VMM: vfree: %p was not allocated by vmalloc\n", ptr);
+    return;
+  }
+
+  VmArea *area = *link;
+  *link = area->next;
+
+  unmap_range(area->start, area->pages);
+  vmAreaCache.free(area);
+}
+
+/*
+ * Maps device memory at a fresh address in the vmalloc range. The HHDM
+ * is built from large pages that the page walkers here cannot split, so
+ * MMIO that needs its own caching attributes gets a 4 KiB mapping of its
+ * own instead. The frames belong to the device and are never handed to
+ * the PMM on iounmap.
+ */
+void *VirtualMemoryManager::ioremap(uint64_t physical_addr, size_t size, uint64_t flags)
+{
+  if (size == 0)
+    return nullptr;
+
+  uint64_t offset = physical_addr & (PAGE_SIZE - 1);
+  uint64_t base = physical_addr - offset;
+  size_t pages = (offset + size + PAGE_SIZE - 1) / PAGE_SIZE;
+
+  VmArea *area = vmAreaCache.alloc();
+  if (!area)
+    return nullptr;
+
+  uint64_t start;
+  VmArea **link = find_vm_gap(pages, &start);
+  if (!link)
+  {
+    printf("VMM: ioremap: Out of virtual address space for %lu pages\n", pages);
+    vmAreaCache.free(area);
+    return nullptr;
+  }
+
+  for (size_t i = 0; i < pages; i++)
+  {
+    map_page(start + i * PAGE_SIZE, base + i * PAGE_SIZE, flags | PRESENT);
+  }
+
+  area->start = start;
+  area->pages = pages;
+  area->io = true;
+  area->next = *link;
+  *link = area;
+
+  return (void *)(start + offset);
+}
+
+void VirtualMemoryManager::iounmap(void *ptr)
+{
+  if (!ptr)
+    return;
+
+  VmArea **link = find_vm_area((uint64_t)ptr & ~(uint64_t)(PAGE_SIZE - 1));
+  if (!link || !(*link)->io)
+  {
+    printf("VMM: iounmap: %p was not mapped by ioremap\n", ptr);
+    return;
+  }
+
+  VmArea *area = *link;
+  *link = area->next;
+
+  for (size_t i = 0; i < area->pages; i++)
+  {
+    clear_page(area->start + i * PAGE_SIZE, false);
+  }
+  invalidate_tlb_range(area->start, area->pages);
+  vmAreaCache.free(area);
+}
+
+void Arena::use_chunk(ArenaChunk *chunk)
+{
+  current = chunk;
+  ptr = (uint8_t *)chunk + sizeof(ArenaChunk);
+  end = (uint8_t *)chunk + chunk->pages * PAGE_SIZE;
+}
+
+void *Arena::alloc_slow(size_t size, size_t align)
+{
+  ArenaChunk *next = current ? current->next : head;
+  ArenaChunk *tail = current;
+
+  while (next)
+  {
+    use_chunk(next);
+    uint8_t *p = (uint8_t *)(((uint64_t)ptr + align - 1) & ~(uint64_t)(align - 1));
+    if (p + size <= end)
+    {
+      ptr = p + size;
+      return p;
+    }
+    tail = next;
+    next = next->next;
+  }
+
+  size_t pages = (sizeof(ArenaChunk) + size + align + PAGE_SIZE - 1) / PAGE_SIZE;
+  uint64_t physical_addr = pmm()->allocBlocks(pages);
+  if (!physical_addr)
+  {
+    printf("Arena: Out of memory! Requested %lu bytes\n", size);
+    return nullptr;
+  }
+
+  ArenaChunk *chunk = (ArenaChunk *)vmm()->physicalToVirtual(physical_addr);
+  chunk->next = nullptr;
+  chunk->pages = pages;
+  if (tail)
+    tail->next = chunk;
+  else
+    head = chunk;
+
+  use_chunk(chunk);
+  uint8_t *p = (uint8_t *)(((uint64_t)ptr + align - 1) & ~(uint64_t)(align - 1));
+  ptr = p + size;
+  return p;
+}
+
+void Arena::rewind(Mark mark)
+{
+  current = mark.chunk;
+  ptr = mark.ptr;
+  end = current ? (uint8_t *)current + current->pages * PAGE_SIZE : nullptr;
+}
+
+void Arena::reset()
+{
+  current = nullptr;
+  ptr = nullptr;
+  end = nullptr;
+}
+
+void Arena::release()
+{
+  ArenaChunk *chunk = head;
+  while (chunk)
+  {
+    ArenaChunk *next = chunk->next;
+    pmm()->freeBlocks((void *)vmm()->virtualToPhysical(chunk), chunk->pages);
+    chunk = next;
+  }
+
+  head = nullptr;
+  reset();
+}
+
+size_t Arena::get_chunk_count() const
+{
+  size_t count = 0;
+  for (ArenaChunk *chunk = head; chunk; chunk = chunk->next)
+  {
+    count++;
+  }
+  return count;
+}
+
 void VirtualMemoryManager::print_memory_map()
 {
   printf("\n=== Virtual Memory Map ===\n");
 
-  printf("PML4 Table: 0x%llx\n", (uint64_t)pml4_table);
-  printf("Kernel Heap: 0x%llx - 0x%llx\n",
-         (uint64_t)heap_start, heap_end);
+  kfmt::print<"PML4 Table: 0x{:x}\n">(pml4_table);
+  kfmt::print<"Kernel Heap: 0x{:x} - 0x{:x}\n">(heap_start, heap_end);
 }
 
 void VirtualMemoryManager::print_page_tables()
@@ -693,24 +1132,27 @@ void VirtualMemoryManager::print_page_tables()
   {
     if (pml4_table->entries[i].is_present())
     {
-      printf("PML4[%lu]: 0x%llx\n", i, pml4_table->entries[i].get_pfn());
+      kfmt::print<"PML4[{}]: 0x{:x}\n">(i, pml4_table->entries[i].get_pfn());
     }
   }
 }
 PageTable *VirtualMemoryManager::clonePageTable(PageTable *src)
 {
-  PageTable *dst = (PageTable *)(pmm()->alloc());
+  PageTable *dst = pageTableCache.alloc();
   if (dst == nullptr)
     return nullptr;
-  dst->clear();
-  copyPageTable(src, dst, 4);
+  if (!copyPageTable(src, dst, 4))
+    return nullptr;
   return dst;
 }
 void VirtualMemoryManager::copyTable(PageTable *dst, PageTable *src)
 {
   memcpy(dst, src, sizeof(PageTable));
 }
-void VirtualMemoryManager::copyPageTable(PageTable *src, PageTable *dst, int level)
+// Tables are reached through the HHDM like everywhere else; dst starts
+// out as a copy of src, so get_table on its entries still finds the
+// source children until they are repointed at their clones.
+bool VirtualMemoryManager::copyPageTable(PageTable *src, PageTable *dst, int level)
 {
   copyTable(dst, src);
 
@@ -726,13 +1168,15 @@ void VirtualMemoryManager::copyPageTable(PageTable *src, PageTable *dst, int lev
           (level == 2 && (e.value & HUGE_PAGE)))
         continue;
 
-      uint64_t childPhys = pmm()->alloc();
-      copyPageTable((PageTable *)(e.get_pfn() << 12), (PageTable *)childPhys, level - 1);
-      if (childPhys == 0)
-        return;
-      e.set_pfn(childPhys >> 12, e.get_flags());
+      PageTable *child = pageTableCache.alloc();
+      if (child == nullptr)
+        return false;
+      if (!copyPageTable(get_table(&e), child, level - 1))
+        return false;
+      e.value = (e.value & ~PTE_FRAME_MASK) | virtualToPhysical(child);
     }
   }
+  return true;
 }
 
 void *VirtualMemoryManager::physicalToVirtual(uint64_t physical_addr)
@@ -747,4 +1191,9 @@ uint64_t VirtualMemoryManager::virtualToPhysical(void *virtual_addr)
   if (virtual_addr == nullptr)
     return 0;
   return (uint64_t)virtual_addr - hhdm_request.response->offset;
+}
+
+uint64_t VirtualMemoryManager::get_hhdm_offset()
+{
+  return hhdm_request.response->offset;
 }
\ No newline at end of file
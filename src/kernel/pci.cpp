@@ -0,0 +1,61 @@
+#include <kernel/pci.h>
+#include <kernel/cpu.h>
+
+static inline uint32_t config_address(uint8_t bus, uint8_t slot, uint8_t function, uint8_t offset) {
+    return 0x80000000u | (uint32_t)bus << 16 | (uint32_t)slot << 11 |
+           (uint32_t)function << 8 | (offset & 0xFC);
+}
+
+static uint32_t read32(uint8_t bus, uint8_t slot, uint8_t function, uint8_t offset) {
+    outl(PCI_CONFIG_ADDRESS, config_address(bus, slot, function, offset));
+    return inl(PCI_CONFIG_DATA);
+}
+
+uint32_t pci_read32(const pci_device *dev, uint8_t offset) {
+    return read32(dev->bus, dev->slot, dev->function, offset);
+}
+
+uint16_t pci_read16(const pci_device *dev, uint8_t offset) {
+    return (uint16_t)(pci_read32(dev, offset) >> ((offset & 2) * 8));
+}
+
+void pci_write32(const pci_device *dev, uint8_t offset, uint32_t value) {
+    outl(PCI_CONFIG_ADDRESS, config_address(dev->bus, dev->slot, dev->function, offset));
+    outl(PCI_CONFIG_DATA, value);
+}
+
+void pci_write16(const pci_device *dev, uint8_t offset, uint16_t value) {
+    outl(PCI_CONFIG_ADDRESS, config_address(dev->bus, dev->slot, dev->function, offset));
+    outw(PCI_CONFIG_DATA + (offset & 2), value);
+}
+
+/*
+ * Brute-force scan of every bus and slot. Functions other than 0 are
+ * only probed on multi-function devices.
+ */
+int pci_find_device(uint16_t vendor_id, uint16_t device_id, pci_device *out) {
+    for (size_t bus = 0; bus < 256; bus++) {
+        for (uint8_t slot = 0; slot < 32; slot++) {
+            if ((uint16_t)read32(bus, slot, 0, PCI_VENDOR_ID) == 0xFFFF) continue;
+
+            uint8_t header = (uint8_t)(read32(bus, slot, 0, PCI_HEADER_TYPE & 0xFC) >> 16);
+            uint8_t functions = (header & 0x80) ? 8 : 1;
+            for (uint8_t function = 0; function < functions; function++) {
+                uint32_t id = read32(bus, slot, function, PCI_VENDOR_ID);
+                if ((uint16_t)id != vendor_id || (uint16_t)(id >> 16) != device_id) continue;
+
+                out->bus = (uint8_t)bus;
+                out->slot = slot;
+                out->function = function;
+                out->vendor_id = vendor_id;
+                out->device_id = device_id;
+                return 1;
+            }
+        }
+    }
+    return 0;
+}
+
+void pci_enable(const pci_device *dev, uint16_t command) {
+    pci_write16(dev, PCI_COMMAND, pci_read16(dev, PCI_COMMAND) | command);
+}
@@ -1,54 +1,349 @@
 #include  <kernel/serial.h>
+#include <kernel/cpu.h>
+#include <kernel/interrupt.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <string.h>
 
-static inline void outb(uint16_t, uint8_t);
-static inline uint8_t inb(uint16_t);
+#define SERIAL_DATA 0
+#define SERIAL_IER 1
+#define SERIAL_IIR 2
+#define SERIAL_FCR 2
+#define SERIAL_LCR 3
+#define SERIAL_MCR 4
+#define SERIAL_LSR 5
+#define SERIAL_MSR 6
+
+#define IER_RX 0x01
+#define IER_THRE 0x02
+#define IER_LINE 0x04
+
+#define IIR_NONE 0x01
+#define IIR_ID_MASK 0x0E
+#define IIR_MODEM 0x00
+#define IIR_THRE 0x02
+#define IIR_RX 0x04
+#define IIR_LINE 0x06
+#define IIR_TIMEOUT 0x0C
+#define IIR_FIFO_ENABLED 0xC0
+
+#define LSR_DATA_READY 0x01
+#define LSR_OVERRUN 0x02
+#define LSR_THRE 0x20
+#define LSR_TEMT 0x40
+
+#define LCR_8N1 0x03
+#define LCR_DLAB 0x80
+/* Enable and clear both FIFOs, RX interrupt at 14 bytes. */
+#define FCR_ENABLE 0xC7
+/* DTR, RTS and OUT2, which gates the interrupt line. */
+#define MCR_DEFAULT 0x0B
+
+static_assert((SERIAL_TX_RING_SIZE & (SERIAL_TX_RING_SIZE - 1)) == 0,
+              "SERIAL_TX_RING_SIZE must be a power of two");
+static_assert((SERIAL_RX_RING_SIZE & (SERIAL_RX_RING_SIZE - 1)) == 0,
+              "SERIAL_RX_RING_SIZE must be a power of two");
+
+static char tx_ring[SERIAL_TX_RING_SIZE];
+static size_t tx_head = 0;
+static size_t tx_tail = 0;
+static char rx_ring[SERIAL_RX_RING_SIZE];
+static size_t rx_head = 0;
+static size_t rx_tail = 0;
+static uint64_t rx_dropped = 0;
+
+static size_t fifo_size = 1;
+static uint32_t base_baud = SERIAL_BASE_BAUD;
+static bool buffered = false;
+static bool tx_active = false;
+static int serial_lock_word = 0;
+
+static uint64_t serial_lock(void) {
+    uint64_t flags = interrupt_save();
+    while (__atomic_exchange_n(&serial_lock_word, 1, __ATOMIC_ACQUIRE)) {
+        __builtin_ia32_pause();
+    }
+    return flags;
+}
+
+static void serial_unlock(uint64_t flags) {
+    __atomic_store_n(&serial_lock_word, 0, __ATOMIC_RELEASE);
+    interrupt_restore(flags);
+}
+
+static void set_divisor(uint16_t divisor) {
+    uint8_t lcr = inb(COM1 + SERIAL_LCR);
+    outb(COM1 + SERIAL_LCR, lcr | LCR_DLAB);
+    outb(COM1 + 0, (uint8_t)divisor);
+    outb(COM1 + 1, (uint8_t)(divisor >> 8));
+    outb(COM1 + SERIAL_LCR, lcr & ~LCR_DLAB);
+}
+
+/*
+ * Sets up the port for polled output. A 16550A reports working FIFOs in
+ * the top bits of IIR once they are enabled; older UARTs only take one
+ * byte per THRE.
+ */
 void serial_initialize(void) {
-    outb(COM1 + 1, 0x00);
-    outb(COM1 + 3, 0x80);
-    outb(COM1 + 0, 0x01);
-    outb(COM1 + 1, 0x00);
-    outb(COM1 + 3, 0x03);
-    outb(COM1 + 2, 0xC7);
-    outb(COM1 + 4, 0x0B);
+    outb(COM1 + SERIAL_IER, 0x00);
+    outb(COM1 + SERIAL_LCR, LCR_8N1);
+    set_divisor(SERIAL_BASE_BAUD / SERIAL_DEFAULT_BAUD);
+    outb(COM1 + SERIAL_FCR, FCR_ENABLE);
+    outb(COM1 + SERIAL_MCR, MCR_DEFAULT);
+    fifo_size = (inb(COM1 + SERIAL_IIR) & IIR_FIFO_ENABLED) == IIR_FIFO_ENABLED ? SERIAL_FIFO_SIZE : 1;
+}
+
+void serial_set_base_baud(uint32_t baud) {
+    base_baud = baud;
+}
+
+/*
+ * Returns 0 if the rate cannot be produced from the base rate within 3%.
+ * Bytes already in the shift register are sent at the old rate first.
+ */
+int serial_set_baud(uint32_t baud) {
+    if (baud == 0 || baud > base_baud) return 0;
+
+    uint32_t divisor = (base_baud + baud / 2) / baud;
+    uint32_t actual = base_baud / divisor;
+    uint32_t error = actual > baud ? actual - baud : baud - actual;
+    if (divisor > 0xFFFF || (uint64_t)error * 100 > (uint64_t)baud * 3) return 0;
+
+    uint64_t flags = serial_lock();
+    while (!(inb(COM1 + SERIAL_LSR) & LSR_TEMT)) {
+        __builtin_ia32_pause();
+    }
+    set_divisor((uint16_t)divisor);
+    serial_unlock(flags);
+    return 1;
+}
+
+/* Moves as much of the transmit ring as fits into the FIFO. THRE must be set. */
+static void fill_fifo(void) {
+    for (size_t room = fifo_size; room > 0 && tx_tail != tx_head; room--) {
+        outb(COM1 + SERIAL_DATA, tx_ring[tx_tail++ & (SERIAL_TX_RING_SIZE - 1)]);
+    }
+}
+
+static void wait_transmit_empty(void) {
+    while (!(inb(COM1 + SERIAL_LSR) & LSR_THRE)) {
+        __builtin_ia32_pause();
+    }
+}
+
+/*
+ * Called with the lock held. The interrupt handler cannot run meanwhile,
+ * so the ring is drained by polling until one FIFO's worth is free.
+ */
+static inline void tx_put(char c) {
+    if (tx_head - tx_tail == SERIAL_TX_RING_SIZE) {
+        wait_transmit_empty();
+        fill_fifo();
+    }
+    tx_ring[tx_head++ & (SERIAL_TX_RING_SIZE - 1)] = c;
+}
+
+/*
+ * Starts transmission if the interrupt handler is not already draining
+ * the ring: the FIFO is filled right away if it is empty, and the THRE
+ * interrupt takes over for whatever does not fit.
+ */
+static void tx_start(void) {
+    if (tx_active || tx_tail == tx_head) return;
+
+    if (inb(COM1 + SERIAL_LSR) & LSR_THRE) {
+        fill_fifo();
+    }
+    if (tx_tail != tx_head) {
+        tx_active = true;
+        outb(COM1 + SERIAL_IER, IER_RX | IER_LINE | IER_THRE);
+    }
+}
+
+static void rx_collect(void) {
+    while (inb(COM1 + SERIAL_LSR) & LSR_DATA_READY) {
+        char c = (char)inb(COM1 + SERIAL_DATA);
+        if (rx_head - rx_tail == SERIAL_RX_RING_SIZE) {
+            rx_dropped++;
+            continue;
+        }
+        rx_ring[rx_head++ & (SERIAL_RX_RING_SIZE - 1)] = c;
+    }
+}
+
+static void serial_interrupt(void) {
+    uint64_t flags = serial_lock();
+    for (;;) {
+        uint8_t iir = inb(COM1 + SERIAL_IIR);
+        if (iir & IIR_NONE) break;
+
+        switch (iir & IIR_ID_MASK) {
+            case IIR_LINE:
+                if (inb(COM1 + SERIAL_LSR) & LSR_OVERRUN) {
+                    rx_dropped++;
+                }
+                break;
+            case IIR_RX:
+            case IIR_TIMEOUT:
+                rx_collect();
+                break;
+            case IIR_THRE:
+                fill_fifo();
+                if (tx_tail == tx_head) {
+                    tx_active = false;
+                    outb(COM1 + SERIAL_IER, IER_RX | IER_LINE);
+                }
+                break;
+            case IIR_MODEM:
+                inb(COM1 + SERIAL_MSR);
+                break;
+        }
+    }
+    serial_unlock(flags);
+}
+
+/* Switches from polling to the ring buffers; the caller enables interrupts. */
+void serial_enable_interrupts(void) {
+    uint64_t flags = serial_lock();
+    irq_register(IRQ_COM1, serial_interrupt);
+    outb(COM1 + SERIAL_IER, IER_RX | IER_LINE);
+    buffered = true;
+    serial_unlock(flags);
+}
+
+/*
+ * Goes back to polled output for good and sends whatever is still in the
+ * transmit ring. Meant for panics, so the lock is ignored: its holder may
+ * be the code that just failed.
+ */
+void serial_panic_flush(void) {
+    __atomic_store_n(&buffered, false, __ATOMIC_RELAXED);
+    outb(COM1 + SERIAL_IER, 0x00);
+    tx_active = false;
+    while (tx_tail != tx_head) {
+        wait_transmit_empty();
+        fill_fifo();
+    }
 }
 
 int serial_received(void) {
-    return inb(COM1 + 5) & 1;
+    if (__atomic_load_n(&buffered, __ATOMIC_RELAXED)) {
+        return __atomic_load_n(&rx_head, __ATOMIC_ACQUIRE) != rx_tail;
+    }
+    return inb(COM1 + SERIAL_LSR) & LSR_DATA_READY;
 }
 
+/* Waits for a byte; with the receive ring in use the CPU halts meanwhile. */
 char serial_read(void) {
-    while (serial_received() == 0);
-    return inb(COM1);
-}
+    if (!__atomic_load_n(&buffered, __ATOMIC_RELAXED)) {
+        while (!(inb(COM1 + SERIAL_LSR) & LSR_DATA_READY)) {
+            __builtin_ia32_pause();
+        }
+        return (char)inb(COM1 + SERIAL_DATA);
+    }
 
-int serial_transmit_empty(void) {
-    return inb(COM1 + 5) & 0x20;
+    uint64_t flags = serial_lock();
+    while (rx_tail == rx_head) {
+        __atomic_store_n(&serial_lock_word, 0, __ATOMIC_RELEASE);
+        if (flags & RFLAGS_IF) {
+            interrupt_wait();
+        } else {
+            rx_collect();
+        }
+        while (__atomic_exchange_n(&serial_lock_word, 1, __ATOMIC_ACQUIRE)) {
+            __builtin_ia32_pause();
+        }
+    }
+    char c = rx_ring[rx_tail++ & (SERIAL_RX_RING_SIZE - 1)];
+    serial_unlock(flags);
+    return c;
 }
 
 void serial_putchar(char c) {
-    while (serial_transmit_empty() == 0);
-    outb(COM1, c);
+    if (!__atomic_load_n(&buffered, __ATOMIC_RELAXED)) {
+        wait_transmit_empty();
+        outb(COM1 + SERIAL_DATA, c);
+        return;
+    }
+
+    uint64_t flags = serial_lock();
+    tx_put(c);
+    tx_start();
+    serial_unlock(flags);
 }
 
 void serial_write(const char *str) {
-    while (*str) {
-        if (*str == '\n') {
-            serial_putchar('\r');
+    serial_write_buffer(str, strlen(str));
+}
+
+/*
+ * Once THRE reports empty the whole FIFO can be filled before polling
+ * the line status register again.
+ */
+static void serial_write_polled(const char *data, size_t size) {
+    size_t i = 0;
+    bool pending_cr = false;
+    while (i < size) {
+        wait_transmit_empty();
+        for (size_t room = fifo_size; room > 0 && i < size; room--) {
+            if (data[i] == '\n' && !pending_cr) {
+                outb(COM1 + SERIAL_DATA, '\r');
+                pending_cr = true;
+                continue;
+            }
+            outb(COM1 + SERIAL_DATA, data[i++]);
+            pending_cr = false;
+        }
+    }
+}
+
+void serial_write_buffer(const char *data, size_t size) {
+    if (!__atomic_load_n(&buffered, __ATOMIC_RELAXED)) {
+        serial_write_polled(data, size);
+        return;
+    }
+
+    uint64_t flags = serial_lock();
+    for (size_t i = 0; i < size; i++) {
+        if (data[i] == '\n') {
+            tx_put('\r');
         }
-        serial_putchar(*str++);
+        tx_put(data[i]);
     }
+    tx_start();
+    serial_unlock(flags);
 }
 
 void serial_printf(const char *fmt, ...) {
-    serial_write(fmt);
+    va_list args;
+    va_start(args, fmt);
+    serial_vprintf(fmt, args);
+    va_end(args);
 }
 
-static inline void outb(uint16_t port, uint8_t value) {
-    asm volatile ("outb %0, %1" : : "a"(value), "Nd"(port));
+void serial_vprintf(const char *fmt, va_list args) {
+    serial_writer writer;
+    writer.length = 0;
+    vcbprintf(serial_writer_write, &writer, fmt, args);
+    serial_writer_flush(&writer);
 }
 
-static inline uint8_t inb(uint16_t port) {
-    uint8_t ret;
-    asm volatile ("inb %1, %0" : "=a"(ret) : "Nd"(port));
-    return ret;
-}
\ No newline at end of file
+void serial_writer_write(void *ctx, const char *data, size_t size) {
+    serial_writer *writer = (serial_writer *)ctx;
+    if (writer->length + size > SERIAL_WRITER_SIZE) {
+        serial_writer_flush(writer);
+        if (size > SERIAL_WRITER_SIZE) {
+            serial_write_buffer(data, size);
+            return;
+        }
+    }
+    memcpy(writer->buffer + writer->length, data, size);
+    writer->length += size;
+}
+
+void serial_writer_flush(serial_writer *writer) {
+    if (writer->length) {
+        serial_write_buffer(writer->buffer, writer->length);
+        writer->length = 0;
+    }
+}
@@ -0,0 +1,363 @@
+#include <stdio.h>
+#include <string.h>
+
+#include <kernel/slab.h>
+#include <kernel/memory.h>
+
+#define KMEM_MIN_ALIGN 8
+#define KMEM_MAX_ORDER 3
+#define KMEM_OFF_SLAB_MAX_OBJECTS 64
+
+struct kmem_off_slab_header
+{
+  kmem_slab slab;
+  uint16_t freelist[KMEM_OFF_SLAB_MAX_OBJECTS];
+};
+
+static kmem_cache cache_cache;
+static kmem_cache slab_header_cache;
+static bool kmem_bootstrapped = false;
+
+static size_t align_up(size_t value, size_t align)
+{
+  return (value + align - 1) & ~(align - 1);
+}
+
+static void list_remove(kmem_slab **head, kmem_slab *slab)
+{
+  if (slab->prev)
+    slab->prev->next = slab->next;
+  else
+    *head = slab->next;
+  if (slab->next)
+    slab->next->prev = slab->prev;
+  slab->next = nullptr;
+  slab->prev = nullptr;
+}
+
+static void list_push(kmem_slab **head, kmem_slab *slab)
+{
+  slab->prev = nullptr;
+  slab->next = *head;
+  if (*head)
+    (*head)->prev = slab;
+  *head = slab;
+}
+
+static size_t hash_index(kmem_cache *cache, uint64_t base)
+{
+  return (base >> (12 + cache->order)) % KMEM_CACHE_HASH_SIZE;
+}
+
+static size_t on_slab_header_size(size_t objects, size_t align)
+{
+  return align_up(sizeof(kmem_slab) + objects * sizeof(uint16_t), align);
+}
+
+static bool kmem_cache_init(kmem_cache *cache, const char *name, size_t size, size_t align, kmem_ctor_t ctor)
+{
+  memset(cache, 0, sizeof(kmem_cache));
+
+  size_t i = 0;
+  for (; name && name[i] && i < KMEM_CACHE_NAME_MAX - 1; i++)
+  {
+    cache->name[i] = name[i];
+  }
+  cache->name[i] = '\0';
+
+  if (align < KMEM_MIN_ALIGN)
+    align = KMEM_MIN_ALIGN;
+  if (align & (align - 1))
+  {
+    printf("SLAB: %s: alignment %lu is not a power of two\n", cache->name, align);
+    return false;
+  }
+
+  cache->object_size = size;
+  cache->align = align;
+  cache->stride = align_up(size, align);
+  cache->ctor = ctor;
+
+  size_t leftover;
+  if (cache->stride <= PAGE_SIZE / 8)
+  {
+    size_t objects = PAGE_SIZE / cache->stride;
+    while (objects > 0 && on_slab_header_size(objects, align) + objects * cache->stride > PAGE_SIZE)
+    {
+      objects--;
+    }
+    cache->order = 0;
+    cache->objects_per_slab = objects;
+    leftover = PAGE_SIZE - on_slab_header_size(objects, align) - objects * cache->stride;
+  }
+  else
+  {
+    cache->off_slab = true;
+    size_t order = 0;
+    while (order < KMEM_MAX_ORDER)
+    {
+      size_t slab_bytes = (size_t)PAGE_SIZE << order;
+      if (slab_bytes >= cache->stride && slab_bytes % cache->stride <= slab_bytes / 8)
+        break;
+      order++;
+    }
+    size_t slab_bytes = (size_t)PAGE_SIZE << order;
+    size_t objects = slab_bytes / cache->stride;
+    if (objects > KMEM_OFF_SLAB_MAX_OBJECTS)
+      objects = KMEM_OFF_SLAB_MAX_OBJECTS;
+    cache->order = order;
+    cache->objects_per_slab = objects;
+    leftover = slab_bytes - objects * cache->stride;
+  }
+
+  if (cache->objects_per_slab == 0)
+  {
+    printf("SLAB: %s: object size %lu is too large\n", cache->name, size);
+    return false;
+  }
+
+  size_t color_unit = align > KMEM_CACHE_LINE_SIZE ? align : KMEM_CACHE_LINE_SIZE;
+  cache->color_max = leftover / color_unit;
+  return true;
+}
+
+static void kmem_bootstrap()
+{
+  kmem_cache_init(&cache_cache, "kmem_cache", sizeof(kmem_cache), KMEM_CACHE_LINE_SIZE, nullptr);
+  kmem_cache_init(&slab_header_cache, "kmem_slab", sizeof(kmem_off_slab_header), KMEM_MIN_ALIGN, nullptr);
+  kmem_bootstrapped = true;
+}
+
+static kmem_slab *kmem_cache_grow(kmem_cache *cache)
+{
+  size_t pages = (size_t)1 << cache->order;
+  uint64_t physical = pmm()->allocBlocksAligned(pages, pages);
+  if (!physical)
+    return nullptr;
+  uint8_t *base = (uint8_t *)vmm()->physicalToVirtual(physical);
+
+  kmem_slab *slab;
+  uint8_t *objects;
+  if (cache->off_slab)
+  {
+    kmem_off_slab_header *header = (kmem_off_slab_header *)kmem_cache_alloc(&slab_header_cache);
+    if (!header)
+    {
+      pmm()->freeBlocks((void *)physical, pages);
+      return nullptr;
+    }
+    slab = &header->slab;
+    slab->freelist = header->freelist;
+    objects = base;
+
+    size_t index = hash_index(cache, (uint64_t)base);
+    slab->hash_next = cache->hash[index];
+    cache->hash[index] = slab;
+  }
+  else
+  {
+    slab = (kmem_slab *)base;
+    slab->freelist = (uint16_t *)(base + sizeof(kmem_slab));
+    slab->hash_next = nullptr;
+    objects = base + on_slab_header_size(cache->objects_per_slab, cache->align);
+  }
+
+  size_t color_unit = cache->align > KMEM_CACHE_LINE_SIZE ? cache->align : KMEM_CACHE_LINE_SIZE;
+  objects += cache->color_next * color_unit;
+  cache->color_next = cache->color_next >= cache->color_max ? 0 : cache->color_next + 1;
+
+  slab->cache = cache;
+  slab->base = base;
+  slab->objects = objects;
+  slab->inuse = 0;
+  slab->next = nullptr;
+  slab->prev = nullptr;
+
+  for (size_t i = 0; i < cache->objects_per_slab; i++)
+  {
+    slab->freelist[i] = (uint16_t)i;
+    if (cache->ctor)
+      cache->ctor(objects + i * cache->stride);
+  }
+
+  cache->total_slabs++;
+  return slab;
+}
+
+static void kmem_slab_destroy(kmem_cache *cache, kmem_slab *slab)
+{
+  size_t pages = (size_t)1 << cache->order;
+  uint8_t *base = slab->base;
+
+  if (cache->off_slab)
+  {
+    kmem_slab **link = &cache->hash[hash_index(cache, (uint64_t)base)];
+    while (*link && *link != slab)
+    {
+      link = &(*link)->hash_next;
+    }
+    if (*link)
+      *link = slab->hash_next;
+    kmem_cache_free(&slab_header_cache, slab);
+  }
+
+  pmm()->freeBlocks((void *)vmm()->virtualToPhysical(base), pages);
+  cache->total_slabs--;
+}
+
+static kmem_slab *kmem_find_slab(kmem_cache *cache, void *obj)
+{
+  if (!cache->off_slab)
+    return (kmem_slab *)((uint64_t)obj & ~(uint64_t)(PAGE_SIZE - 1));
+
+  uint64_t base = (uint64_t)obj & ~(((uint64_t)PAGE_SIZE << cache->order) - 1);
+  for (kmem_slab *slab = cache->hash[hash_index(cache, base)]; slab; slab = slab->hash_next)
+  {
+    if ((uint64_t)slab->base == base)
+      return slab;
+  }
+  return nullptr;
+}
+
+kmem_cache *kmem_cache_create(const char *name, size_t size, size_t align, kmem_ctor_t ctor)
+{
+  if (!kmem_bootstrapped)
+    kmem_bootstrap();
+
+  kmem_cache *cache = (kmem_cache *)kmem_cache_alloc(&cache_cache);
+  if (!cache)
+  {
+    printf("SLAB: Failed to create cache %s\n", name);
+    return nullptr;
+  }
+
+  if (!kmem_cache_init(cache, name, size, align, ctor))
+  {
+    kmem_cache_free(&cache_cache, cache);
+    return nullptr;
+  }
+  return cache;
+}
+
+void kmem_cache_destroy(kmem_cache *cache)
+{
+  if (!cache)
+    return;
+
+  if (cache->active_objects)
+  {
+    printf("SLAB: Destroying cache %s with %lu live objects\n", cache->name, cache->active_objects);
+  }
+
+  kmem_slab **lists[] = {&cache->full, &cache->partial, &cache->free};
+  for (kmem_slab **list : lists)
+  {
+    while (*list)
+    {
+      kmem_slab *slab = *list;
+      list_remove(list, slab);
+      kmem_slab_destroy(cache, slab);
+    }
+  }
+
+  kmem_cache_free(&cache_cache, cache);
+}
+
+void *kmem_cache_alloc(kmem_cache *cache)
+{
+  kmem_slab *slab = cache->partial;
+  if (!slab)
+  {
+    slab = cache->free;
+    if (slab)
+    {
+      list_remove(&cache->free, slab);
+      cache->free_slabs--;
+    }
+    else
+    {
+      slab = kmem_cache_grow(cache);
+      if (!slab)
+      {
+        printf("SLAB: %s: Out of memory!\n", cache->name);
+        return nullptr;
+      }
+    }
+    list_push(&cache->partial, slab);
+  }
+
+  uint16_t index = slab->freelist[slab->inuse++];
+  if (slab->inuse == cache->objects_per_slab)
+  {
+    list_remove(&cache->partial, slab);
+    list_push(&cache->full, slab);
+  }
+
+  cache->active_objects++;
+  return slab->objects + index * cache->stride;
+}
+
+void kmem_cache_free(kmem_cache *cache, void *obj)
+{
+  if (!obj)
+    return;
+
+  kmem_slab *slab = kmem_find_slab(cache, obj);
+  if (!slab || slab->cache != cache)
+  {
+    printf("SLAB: %s: Freeing foreign object %p\n", cache->name, obj);
+    return;
+  }
+
+  size_t offset = (uint8_t *)obj - slab->objects;
+  if (offset % cache->stride != 0 || offset / cache->stride >= cache->objects_per_slab)
+  {
+    printf("SLAB: %s: Freeing misaligned object %p\n", cache->name, obj);
+    return;
+  }
+
+  if (slab->inuse == cache->objects_per_slab)
+  {
+    list_remove(&cache->full, slab);
+    list_push(&cache->partial, slab);
+  }
+
+  slab->freelist[--slab->inuse] = (uint16_t)(offset / cache->stride);
+  cache->active_objects--;
+
+  if (slab->inuse == 0)
+  {
+    list_remove(&cache->partial, slab);
+    if (cache->free_slabs >= KMEM_CACHE_MAX_FREE_SLABS)
+    {
+      kmem_slab_destroy(cache, slab);
+    }
+    else
+    {
+      list_push(&cache->free, slab);
+      cache->free_slabs++;
+    }
+  }
+}
+
+size_t kmem_cache_shrink(kmem_cache *cache)
+{
+  size_t released = 0;
+  while (cache->free)
+  {
+    kmem_slab *slab = cache->free;
+    list_remove(&cache->free, slab);
+    kmem_slab_destroy(cache, slab);
+    released++;
+  }
+  cache->free_slabs = 0;
+  return released;
+}
+
+void kmem_cache_print_stats(kmem_cache *cache)
+{
+  printf("SLAB: %s: size %lu stride %lu order %lu objs/slab %lu slabs %lu active %lu colors %lu%s\n",
+         cache->name, cache->object_size, cache->stride, cache->order,
+         cache->objects_per_slab, cache->total_slabs, cache->active_objects,
+         cache->color_max + 1, cache->off_slab ? " off-slab" : "");
+}
@@ -1,7 +1,10 @@
 #include <kernel/terminal.h>
 #include <kernel/font.h>
+#include <kernel/framebuffer.h>
+#include <kernel/memory.h>
 #include <limine.h>
 #include <stdarg.h>
+#include <stdio.h>
 #include <string.h>
 
 static volatile struct limine_framebuffer_request framebuffer_request = {
@@ -10,11 +13,104 @@ static volatile struct limine_framebuffer_request framebuffer_request = {
 };
 
 static struct limine_framebuffer *framebuffer = NULL;
+static const struct fb_renderer *renderer = NULL;
 static size_t terminal_row = 0;
 static size_t terminal_column = 0;
 static uint32_t foreground_color = 0xFFFFFFFF; // 白色
 static uint32_t background_color = 0x00000000; // 黑色
 
+/*
+ * glyph_rows[bits] holds the eight expanded pixels of a font row whose
+ * bit pattern is bits, for the foreground/background pair it was built
+ * for, so a glyph row is drawn with a few 64-bit stores instead of eight
+ * pixel writes.
+ */
+static fb_glyph_rows glyph_rows __attribute__((aligned(64)));
+static uint32_t glyph_rows_fg = 0;
+static uint32_t glyph_rows_bg = 0;
+static bool glyph_rows_valid = false;
+
+/*
+ * Once the VMM is up the console draws into a RAM shadow of the
+ * framebuffer. Drawing records the touched span of every scanline and
+ * terminal_flush copies only those spans out, so video memory is only
+ * ever written, including when scrolling.
+ */
+static uint8_t *shadow = NULL;
+static uint32_t *dirty_left = NULL;
+static uint32_t *dirty_right = NULL;
+static size_t dirty_top = 0;
+static size_t dirty_bottom = 0;
+static bool dirty_all = false;
+static terminal_flush_policy flush_policy = TERMINAL_FLUSH_IMMEDIATE;
+
+/*
+ * The text itself lives in a ring of character rows; screen row r is ring
+ * row (screen_top + r) % history_rows, so scrolling only advances
+ * screen_top and the rows that fall off the top stay around as
+ * scrollback. Each cell packs the character with 24-bit foreground and
+ * background colors. displayed[] remembers what is currently drawn at
+ * every screen position, and rendering a damaged row only redraws the
+ * cells that differ from it.
+ */
+typedef uint64_t terminal_cell;
+
+static terminal_cell history[TERMINAL_HISTORY_CELLS];
+static terminal_cell displayed[TERMINAL_SCREEN_CELLS];
+static uint8_t row_damaged[TERMINAL_MAX_ROWS];
+static bool any_damage = false;
+static size_t columns = 0;
+static size_t rows = 0;
+static size_t history_rows = 0;
+static size_t history_filled = 0;
+static size_t screen_top = 0;
+static size_t view_offset = 0;
+
+static void ansi_reset(void);
+
+static inline terminal_cell make_cell(char c, uint32_t fg, uint32_t bg) {
+    return (uint8_t)c | (uint64_t)(fg & 0xFFFFFF) << 8 | (uint64_t)(bg & 0xFFFFFF) << 32;
+}
+
+static inline char cell_char(terminal_cell cell) {
+    return (char)(cell & 0xFF);
+}
+
+static inline uint32_t cell_fg(terminal_cell cell) {
+    return (cell >> 8) & 0xFFFFFF;
+}
+
+static inline uint32_t cell_bg(terminal_cell cell) {
+    return (cell >> 32) & 0xFFFFFF;
+}
+
+static inline terminal_cell *history_row(size_t ring_row) {
+    return &history[(ring_row % history_rows) * columns];
+}
+
+static inline terminal_cell *screen_row(size_t row) {
+    return history_row(screen_top + row);
+}
+
+static inline void damage_row(size_t row) {
+    row_damaged[row] = 1;
+    any_damage = true;
+}
+
+static void damage_all(void) {
+    for (size_t row = 0; row < rows; row++) {
+        row_damaged[row] = 1;
+    }
+    any_damage = true;
+}
+
+static void clear_cells(terminal_cell *cells, size_t count) {
+    terminal_cell blank = make_cell(' ', foreground_color, background_color);
+    for (size_t i = 0; i < count; i++) {
+        cells[i] = blank;
+    }
+}
+
 volatile struct limine_framebuffer_request* get_framebuffer_request() {
     return &framebuffer_request;
 }
@@ -26,142 +122,904 @@ void terminal_initialize(void) {
     }
     
     framebuffer = framebuffer_request.response->framebuffers[0];
+    renderer = fb_select_renderer(framebuffer);
+    if (!renderer) {
+        framebuffer = NULL;
+        return;
+    }
     terminal_row = 0;
     terminal_column = 0;
+
+    columns = framebuffer->width / FONT_WIDTH;
+    rows = framebuffer->height / FONT_HEIGHT;
+    if (columns > TERMINAL_SCREEN_CELLS) columns = TERMINAL_SCREEN_CELLS;
+    if (rows > TERMINAL_MAX_ROWS) rows = TERMINAL_MAX_ROWS;
+    if (columns && rows > TERMINAL_SCREEN_CELLS / columns) rows = TERMINAL_SCREEN_CELLS / columns;
+    history_rows = columns ? TERMINAL_HISTORY_CELLS / columns : 0;
+    screen_top = 0;
+    view_offset = 0;
+    ansi_reset();
     
     terminal_clear();
 }
 
-static void set_pixel(size_t x, size_t y, uint32_t color) {
-    if (x >= framebuffer->width || y >= framebuffer->height) {
-        return;
+static inline uint8_t *draw_target(void) {
+    return shadow ? shadow : (uint8_t*)framebuffer->address;
+}
+
+/* The shadow is read back by terminal_flush, so only the framebuffer is streamed to. */
+static inline bool draw_target_streaming(void) {
+    return shadow == NULL;
+}
+
+static void reset_dirty(void) {
+    for (size_t y = dirty_top; y < dirty_bottom; y++) {
+        dirty_left[y] = UINT32_MAX;
+        dirty_right[y] = 0;
     }
-    
-    uint64_t pitch = framebuffer->pitch;
-    uint64_t index = y * pitch + x * (framebuffer->bpp / 8);
-    uint32_t *pixel = (uint32_t*)((uint8_t*)framebuffer->address + index);
-    *pixel = color;
+    dirty_top = framebuffer->height;
+    dirty_bottom = 0;
+    dirty_all = false;
+}
+
+static void mark_dirty(size_t x, size_t y, size_t width, size_t height) {
+    if (!shadow) return;
+
+    if (x + width > framebuffer->width) width = framebuffer->width - x;
+    if (y + height > framebuffer->height) height = framebuffer->height - y;
+
+    for (size_t row = y; row < y + height; row++) {
+        if (dirty_left[row] > x) dirty_left[row] = x;
+        if (dirty_right[row] < x + width) dirty_right[row] = x + width;
+    }
+    if (dirty_top > y) dirty_top = y;
+    if (dirty_bottom < y + height) dirty_bottom = y + height;
+}
+
+static void mark_all_dirty(void) {
+    if (!shadow) return;
+    dirty_all = true;
+    dirty_top = 0;
+    dirty_bottom = framebuffer->height;
+}
+
+static void build_glyph_rows(uint32_t fg, uint32_t bg) {
+    renderer->expand_glyph_rows(glyph_rows, fg, bg);
+    glyph_rows_fg = fg;
+    glyph_rows_bg = bg;
+    glyph_rows_valid = true;
 }
 
 static void draw_char(char c, size_t x, size_t y, uint32_t fg, uint32_t bg) {
     const uint8_t *glyph = font_8x16[(unsigned char)c];
-    
-    for (size_t gy = 0; gy < FONT_HEIGHT; gy++) {
-        uint8_t row = glyph[gy];
-        for (size_t gx = 0; gx < FONT_WIDTH; gx++) {
-            if (row & (1 << (7 - gx))) {
-                set_pixel(x + gx, y + gy, fg);
-            } else {
-                set_pixel(x + gx, y + gy, bg);
-            }
-        }
+
+    if (x + FONT_WIDTH > framebuffer->width || y + FONT_HEIGHT > framebuffer->height) {
+        return;
     }
-}
 
-void terminal_clear(void) {
-    if (!framebuffer) return;
-    
-    for (size_t y = 0; y < framebuffer->height; y++) {
-        for (size_t x = 0; x < framebuffer->width; x++) {
-            set_pixel(x, y, background_color);
-        }
+    mark_dirty(x, y, FONT_WIDTH, FONT_HEIGHT);
+
+    if (!glyph_rows_valid || fg != glyph_rows_fg || bg != glyph_rows_bg) {
+        build_glyph_rows(fg, bg);
     }
-    
-    terminal_row = 0;
-    terminal_column = 0;
+
+    uint64_t pitch = framebuffer->pitch;
+    renderer->draw_glyph(draw_target() + y * pitch + x * renderer->bytes_per_pixel,
+                         pitch, glyph, glyph_rows);
 }
 
-void terminal_set_color(uint32_t foreground, uint32_t background) {
-    foreground_color = foreground;
-    background_color = background;
+static void fill_cells(size_t col, size_t row, size_t count, uint32_t bg) {
+    size_t x = col * FONT_WIDTH;
+    size_t y = row * FONT_HEIGHT;
+    size_t width = count * FONT_WIDTH;
+    if (x + width > framebuffer->width || y + FONT_HEIGHT > framebuffer->height) {
+        return;
+    }
+
+    mark_dirty(x, y, width, FONT_HEIGHT);
+    renderer->fill_rect(draw_target() + y * framebuffer->pitch + x * renderer->bytes_per_pixel,
+                        framebuffer->pitch, width, FONT_HEIGHT, bg, draw_target_streaming());
 }
 
-static void scroll(void) {
-    if (!framebuffer) return;
-    
-    size_t char_height = FONT_HEIGHT;
-    size_t char_width = FONT_WIDTH;
-    size_t screen_width = framebuffer->width;
-    size_t screen_height = framebuffer->height;
-    
-    size_t rows = screen_height / char_height;
-    
-    if (terminal_row >= rows) {
-        size_t scroll_pixels = char_height;
-        size_t bytes_per_pixel = framebuffer->bpp / 8;
-        
-        uint8_t *dst = (uint8_t*)framebuffer->address;
-        uint8_t *src = dst + scroll_pixels * framebuffer->pitch;
-        size_t copy_size = (screen_height - scroll_pixels) * framebuffer->pitch;
-        
-        memcpy(dst, src, copy_size);
-        
-        for (size_t y = screen_height - scroll_pixels; y < screen_height; y++) {
-            for (size_t x = 0; x < screen_width; x++) {
-                set_pixel(x, y, background_color);
+/*
+ * Draws every cell of the damaged rows whose contents differ from what is
+ * already on screen. When scrollback is being viewed the rows come from
+ * further back in the ring.
+ */
+static void render(void) {
+    if (!any_damage) return;
+
+    size_t top = screen_top + history_rows - view_offset;
+    for (size_t row = 0; row < rows; row++) {
+        if (!row_damaged[row]) continue;
+        row_damaged[row] = 0;
+
+        const terminal_cell *cells = history_row(top + row);
+        terminal_cell *shown = &displayed[row * columns];
+        for (size_t col = 0; col < columns; col++) {
+            terminal_cell cell = cells[col];
+            if (cell == shown[col]) continue;
+            shown[col] = cell;
+
+            if (cell_char(cell) != ' ') {
+                draw_char(cell_char(cell), col * FONT_WIDTH, row * FONT_HEIGHT,
+                          cell_fg(cell), cell_bg(cell));
+                continue;
+            }
+
+            /* Runs of changed blanks, typically a freshly cleared row, are filled. */
+            size_t run = 1;
+            uint32_t bg = cell_bg(cell);
+            while (col + run < columns && cells[col + run] != shown[col + run] &&
+                   cell_char(cells[col + run]) == ' ' && cell_bg(cells[col + run]) == bg) {
+                shown[col + run] = cells[col + run];
+                run++;
             }
+            fill_cells(col, row, run, bg);
+            col += run - 1;
         }
-        
-        terminal_row = rows - 1;
     }
+    any_damage = false;
 }
 
-void terminal_putchar(char c) {
+void terminal_clear(void) {
     if (!framebuffer) return;
     
-    size_t char_width = FONT_WIDTH;
-    size_t char_height = FONT_HEIGHT;
-    struct limine_framebuffer *frameb = framebuffer;
-    size_t screen_width = frameb->width;
-    size_t screen_height = frameb->height;
+    renderer->fill_rect(draw_target(), framebuffer->pitch,
+                        framebuffer->width, framebuffer->height, background_color,
+                        draw_target_streaming());
+    mark_all_dirty();
+
+    for (size_t row = 0; row < rows; row++) {
+        clear_cells(screen_row(row), columns);
+        row_damaged[row] = 0;
+    }
+    clear_cells(displayed, rows * columns);
+    any_damage = false;
+    if (history_filled < rows) history_filled = rows;
+    view_offset = 0;
     
+    terminal_row = 0;
+    terminal_column = 0;
+}
+
+/*
+ * Applies one character to a cursor given as a line relative to the
+ * current screen top. Characters on lines below first_kept are not
+ * stored; the first pass of terminal_write_cells passes SIZE_MAX to only
+ * move the cursor.
+ */
+static inline void put_char(char c, size_t *line, size_t *col, size_t first_kept) {
     switch (c) {
         case '\n':
-            terminal_column = 0;
-            terminal_row++;
+            *col = 0;
+            (*line)++;
             break;
         case '\r':
-            terminal_column = 0;
+            *col = 0;
             break;
         case '\t':
-            terminal_column = (terminal_column + 4) & ~(4 - 1);
+            *col = (*col + 4) & ~(4 - 1);
             break;
         case '\b':
-            if (terminal_column > 0) {
-                terminal_column--;
-                size_t x = terminal_column * char_width;
-                size_t y = terminal_row * char_height;
-                for (size_t gy = 0; gy < char_height; gy++) {
-                    for (size_t gx = 0; gx < char_width; gx++) {
-                        set_pixel(x + gx, y + gy, background_color);
-                    }
+            if (*col > 0) {
+                (*col)--;
+                if (*line >= first_kept) {
+                    history_row(screen_top + *line)[*col] = make_cell(' ', foreground_color, background_color);
+                    if (*line < rows) damage_row(*line);
                 }
             }
             break;
         default:
             if ((unsigned char)c >= 32 && (unsigned char)c <= 126) {
-                size_t x = terminal_column * char_width;
-                size_t y = terminal_row * char_height;
-                draw_char(c, x, y, foreground_color, background_color);
-                terminal_column++;
+                if (*line >= first_kept) {
+                    history_row(screen_top + *line)[*col] = make_cell(c, foreground_color, background_color);
+                    if (*line < rows) damage_row(*line);
+                }
+                (*col)++;
             }
             break;
     }
-    
-    if (terminal_column * char_width >= screen_width) {
-        terminal_column = 0;
+
+    if (*col >= columns) {
+        *col = 0;
+        (*line)++;
+    }
+}
+
+/*
+ * Writes a whole buffer with at most one scroll. A first pass only moves
+ * the cursor to find out how many lines the buffer scrolls by; the new
+ * lines are cleared and the screen top advanced once, and the second pass
+ * stores only characters on lines that are still inside the history ring
+ * afterwards.
+ */
+static void terminal_write_cells(const char *data, size_t size) {
+    size_t line = terminal_row;
+    size_t col = terminal_column;
+    for (size_t i = 0; i < size; i++) {
+        put_char(data[i], &line, &col, SIZE_MAX);
+    }
+
+    size_t scroll = line >= rows ? line - (rows - 1) : 0;
+    size_t end = rows + scroll;
+    size_t first_kept = end > history_rows ? end - history_rows : 0;
+
+    for (size_t l = first_kept > rows ? first_kept : rows; l < end; l++) {
+        clear_cells(history_row(screen_top + l), columns);
+    }
+
+    line = terminal_row;
+    col = terminal_column;
+    for (size_t i = 0; i < size; i++) {
+        put_char(data[i], &line, &col, first_kept);
+    }
+
+    if (scroll) {
+        screen_top = (screen_top + scroll) % history_rows;
+        history_filled = history_filled + scroll < history_rows ? history_filled + scroll : history_rows;
+        damage_all();
+    }
+    terminal_row = line - scroll;
+    terminal_column = col;
+}
+
+/*
+ * Escape sequences. The scroll region spans screen rows region_top to
+ * region_bottom inclusive; when it covers the whole screen, scrolling
+ * advances the history ring as usual, otherwise only the rows inside the
+ * region are moved and the rows outside it, such as a status header, are
+ * left alone.
+ */
+static size_t region_top = 0;
+static size_t region_bottom = 0;
+static size_t saved_row = 0;
+static size_t saved_column = 0;
+
+/* Colors selected by SGR, before bold and reverse video are applied. */
+static uint32_t default_foreground = 0xFFFFFF;
+static uint32_t default_background = 0x000000;
+static uint32_t text_foreground = 0xFFFFFF;
+static uint32_t text_background = 0x000000;
+static int text_foreground_index = -1;
+static bool text_bold = false;
+static bool text_reverse = false;
+
+static const uint32_t ansi_palette[16] = {
+    0x000000, 0xAA0000, 0x00AA00, 0xAA5500, 0x0000AA, 0xAA00AA, 0x00AAAA, 0xAAAAAA,
+    0x555555, 0xFF5555, 0x55FF55, 0xFFFF55, 0x5555FF, 0xFF55FF, 0x55FFFF, 0xFFFFFF
+};
+
+static inline bool region_is_screen(void) {
+    return region_top == 0 && region_bottom == rows - 1;
+}
+
+/* Moves rows top to bottom inclusive up by count and clears the rows left behind. */
+static void scroll_rows_up(size_t top, size_t bottom, size_t count) {
+    if (count > bottom - top + 1) count = bottom - top + 1;
+
+    for (size_t row = top; row + count <= bottom; row++) {
+        memcpy(screen_row(row), screen_row(row + count), columns * sizeof(terminal_cell));
+        damage_row(row);
+    }
+    for (size_t row = bottom + 1 - count; row <= bottom; row++) {
+        clear_cells(screen_row(row), columns);
+        damage_row(row);
+    }
+}
+
+static void scroll_rows_down(size_t top, size_t bottom, size_t count) {
+    if (count > bottom - top + 1) count = bottom - top + 1;
+
+    for (size_t row = bottom; row >= top + count; row--) {
+        memcpy(screen_row(row), screen_row(row - count), columns * sizeof(terminal_cell));
+        damage_row(row);
+    }
+    for (size_t row = top; row < top + count; row++) {
+        clear_cells(screen_row(row), columns);
+        damage_row(row);
+    }
+}
+
+static void scroll_up(size_t count) {
+    if (!count) return;
+    if (!region_is_screen()) {
+        scroll_rows_up(region_top, region_bottom, count);
+        return;
+    }
+
+    if (count > rows) count = rows;
+    for (size_t l = rows; l < rows + count; l++) {
+        clear_cells(history_row(screen_top + l), columns);
+    }
+    screen_top = (screen_top + count) % history_rows;
+    history_filled = history_filled + count < history_rows ? history_filled + count : history_rows;
+    damage_all();
+}
+
+static void scroll_down(size_t count) {
+    if (count) scroll_rows_down(region_top, region_bottom, count);
+}
+
+static void line_feed(void) {
+    if (terminal_row == region_bottom) {
+        scroll_up(1);
+    } else if (terminal_row + 1 < rows) {
         terminal_row++;
     }
-    
-    if ((terminal_row + 1) * char_height >= screen_height) {
-        scroll();
+}
+
+static void reverse_line_feed(void) {
+    if (terminal_row == region_top) {
+        scroll_down(1);
+    } else if (terminal_row > 0) {
+        terminal_row--;
     }
 }
 
-void terminal_write(const char* data, size_t size) {
+/*
+ * Text without escape sequences. With the scroll region covering the
+ * screen the whole run goes through the batched writer; otherwise each
+ * line feed has to respect the region.
+ */
+static void terminal_write_text(const char *data, size_t size) {
+    if (region_is_screen()) {
+        terminal_write_cells(data, size);
+        return;
+    }
+
     for (size_t i = 0; i < size; i++) {
-        terminal_putchar(data[i]);
+        size_t line = terminal_row;
+        size_t col = terminal_column;
+        put_char(data[i], &line, &col, 0);
+        terminal_column = col;
+        if (line != terminal_row) {
+            line_feed();
+        }
+    }
+}
+
+static void erase_cells(size_t row, size_t from, size_t to) {
+    if (from >= to) return;
+    clear_cells(screen_row(row) + from, to - from);
+    damage_row(row);
+}
+
+static void apply_attributes(void) {
+    uint32_t fg = text_foreground;
+    if (text_bold && text_foreground_index >= 0 && text_foreground_index < 8) {
+        fg = ansi_palette[text_foreground_index + 8];
+    }
+    foreground_color = text_reverse ? text_background : fg;
+    background_color = text_reverse ? fg : text_background;
+}
+
+static void reset_attributes(void) {
+    text_foreground = default_foreground;
+    text_background = default_background;
+    text_foreground_index = -1;
+    text_bold = false;
+    text_reverse = false;
+    apply_attributes();
+}
+
+void terminal_set_color(uint32_t foreground, uint32_t background) {
+    default_foreground = foreground & 0xFFFFFF;
+    default_background = background & 0xFFFFFF;
+    reset_attributes();
+}
+
+static uint32_t color_256(size_t index) {
+    static const uint8_t levels[6] = {0, 95, 135, 175, 215, 255};
+    if (index < 16) {
+        return ansi_palette[index];
     }
+    if (index < 232) {
+        index -= 16;
+        return (uint32_t)levels[index / 36] << 16 | (uint32_t)levels[index / 6 % 6] << 8 | levels[index % 6];
+    }
+    uint32_t gray = 8 + 10 * (uint32_t)(index - 232);
+    return gray << 16 | gray << 8 | gray;
+}
+
+/*
+ * CSI parser state. Table entries hold the action to run in the high
+ * nibble and the next state in the low nibble; bytes are first reduced
+ * to a handful of classes so the table stays small.
+ */
+#define ANSI_MAX_PARAMS 16
+#define ANSI_MAX_PARAM_VALUE 9999
+
+enum ansi_state : uint8_t {
+    ANSI_GROUND,
+    ANSI_ESCAPE,
+    ANSI_ESCAPE_INTERMEDIATE,
+    ANSI_CSI,
+    ANSI_CSI_IGNORE,
+    ANSI_OSC,
+    ANSI_STATE_COUNT
+};
+
+enum ansi_class : uint8_t {
+    ANSI_CLASS_CONTROL,
+    ANSI_CLASS_BELL,
+    ANSI_CLASS_ESCAPE,
+    ANSI_CLASS_CANCEL,
+    ANSI_CLASS_INTERMEDIATE,
+    ANSI_CLASS_DIGIT,
+    ANSI_CLASS_SEPARATOR,
+    ANSI_CLASS_PRIVATE,
+    ANSI_CLASS_CSI_START,
+    ANSI_CLASS_OSC_START,
+    ANSI_CLASS_FINAL,
+    ANSI_CLASS_IGNORE,
+    ANSI_CLASS_COUNT
+};
+
+enum ansi_action : uint8_t {
+    ANSI_NONE,
+    ANSI_PRINT,
+    ANSI_EXECUTE,
+    ANSI_CLEAR,
+    ANSI_PARAM,
+    ANSI_MARK_PRIVATE,
+    ANSI_ESC_DISPATCH,
+    ANSI_CSI_DISPATCH
+};
+
+struct ansi_tables {
+    uint8_t byte_class[256];
+    uint8_t transition[ANSI_STATE_COUNT][ANSI_CLASS_COUNT];
+};
+
+static constexpr uint8_t ansi_entry(ansi_action action, ansi_state next) {
+    return (uint8_t)(action << 4 | next);
+}
+
+static constexpr ansi_tables build_ansi_tables(void) {
+    ansi_tables t = {};
+
+    for (size_t c = 0; c < 256; c++) {
+        uint8_t cls = ANSI_CLASS_IGNORE;
+        if (c == 0x1B) cls = ANSI_CLASS_ESCAPE;
+        else if (c == 0x07) cls = ANSI_CLASS_BELL;
+        else if (c == 0x18 || c == 0x1A) cls = ANSI_CLASS_CANCEL;
+        else if (c < 0x20) cls = ANSI_CLASS_CONTROL;
+        else if (c < 0x30) cls = ANSI_CLASS_INTERMEDIATE;
+        else if (c <= '9') cls = ANSI_CLASS_DIGIT;
+        else if (c == ':' || c == ';') cls = ANSI_CLASS_SEPARATOR;
+        else if (c < 0x40) cls = ANSI_CLASS_PRIVATE;
+        else if (c == '[') cls = ANSI_CLASS_CSI_START;
+        else if (c == ']') cls = ANSI_CLASS_OSC_START;
+        else if (c < 0x7F) cls = ANSI_CLASS_FINAL;
+        t.byte_class[c] = cls;
+    }
+
+    for (size_t s = 0; s < ANSI_STATE_COUNT; s++) {
+        for (size_t cls = 0; cls < ANSI_CLASS_COUNT; cls++) {
+            t.transition[s][cls] = ansi_entry(ANSI_NONE, (ansi_state)s);
+        }
+        /* These behave the same everywhere, even in the middle of a sequence. */
+        t.transition[s][ANSI_CLASS_CONTROL] = ansi_entry(ANSI_EXECUTE, (ansi_state)s);
+        t.transition[s][ANSI_CLASS_ESCAPE] = ansi_entry(ANSI_CLEAR, ANSI_ESCAPE);
+        t.transition[s][ANSI_CLASS_CANCEL] = ansi_entry(ANSI_NONE, ANSI_GROUND);
+    }
+
+    for (size_t cls = ANSI_CLASS_INTERMEDIATE; cls <= ANSI_CLASS_FINAL; cls++) {
+        t.transition[ANSI_GROUND][cls] = ansi_entry(ANSI_PRINT, ANSI_GROUND);
+        t.transition[ANSI_ESCAPE][cls] = ansi_entry(ANSI_ESC_DISPATCH, ANSI_GROUND);
+        t.transition[ANSI_ESCAPE_INTERMEDIATE][cls] = ansi_entry(ANSI_NONE, ANSI_GROUND);
+        t.transition[ANSI_CSI][cls] = ansi_entry(ANSI_CSI_DISPATCH, ANSI_GROUND);
+        t.transition[ANSI_CSI_IGNORE][cls] = ansi_entry(ANSI_NONE, ANSI_GROUND);
+    }
+    t.transition[ANSI_GROUND][ANSI_CLASS_CONTROL] = ansi_entry(ANSI_PRINT, ANSI_GROUND);
+
+    t.transition[ANSI_ESCAPE][ANSI_CLASS_INTERMEDIATE] = ansi_entry(ANSI_NONE, ANSI_ESCAPE_INTERMEDIATE);
+    t.transition[ANSI_ESCAPE][ANSI_CLASS_CSI_START] = ansi_entry(ANSI_CLEAR, ANSI_CSI);
+    t.transition[ANSI_ESCAPE][ANSI_CLASS_OSC_START] = ansi_entry(ANSI_NONE, ANSI_OSC);
+    t.transition[ANSI_ESCAPE_INTERMEDIATE][ANSI_CLASS_INTERMEDIATE] = ansi_entry(ANSI_NONE, ANSI_ESCAPE_INTERMEDIATE);
+
+    t.transition[ANSI_CSI][ANSI_CLASS_DIGIT] = ansi_entry(ANSI_PARAM, ANSI_CSI);
+    t.transition[ANSI_CSI][ANSI_CLASS_SEPARATOR] = ansi_entry(ANSI_PARAM, ANSI_CSI);
+    t.transition[ANSI_CSI][ANSI_CLASS_PRIVATE] = ansi_entry(ANSI_MARK_PRIVATE, ANSI_CSI);
+    t.transition[ANSI_CSI][ANSI_CLASS_INTERMEDIATE] = ansi_entry(ANSI_NONE, ANSI_CSI_IGNORE);
+    for (size_t cls = ANSI_CLASS_INTERMEDIATE; cls <= ANSI_CLASS_PRIVATE; cls++) {
+        t.transition[ANSI_CSI_IGNORE][cls] = ansi_entry(ANSI_NONE, ANSI_CSI_IGNORE);
+    }
+
+    /* Operating system commands, e.g. window titles, end with BEL or ESC \. */
+    for (size_t cls = 0; cls < ANSI_CLASS_COUNT; cls++) {
+        t.transition[ANSI_OSC][cls] = ansi_entry(ANSI_NONE, ANSI_OSC);
+    }
+    t.transition[ANSI_OSC][ANSI_CLASS_BELL] = ansi_entry(ANSI_NONE, ANSI_GROUND);
+    t.transition[ANSI_OSC][ANSI_CLASS_ESCAPE] = ansi_entry(ANSI_CLEAR, ANSI_ESCAPE);
+    t.transition[ANSI_OSC][ANSI_CLASS_CANCEL] = ansi_entry(ANSI_NONE, ANSI_GROUND);
+
+    return t;
+}
+
+static constexpr ansi_tables ansi = build_ansi_tables();
+
+static uint8_t ansi_current = ANSI_GROUND;
+static uint16_t ansi_params[ANSI_MAX_PARAMS];
+static size_t ansi_param_count = 0;
+static bool ansi_private = false;
+
+static inline size_t ansi_param(size_t index, size_t fallback) {
+    return index < ansi_param_count && ansi_params[index] ? ansi_params[index] : fallback;
+}
+
+static void ansi_collect(char c) {
+    if (ansi_param_count == 0) {
+        ansi_params[0] = 0;
+        ansi_param_count = 1;
+    }
+    if (c >= '0' && c <= '9') {
+        uint16_t *value = &ansi_params[ansi_param_count - 1];
+        uint32_t next = *value * 10u + (uint32_t)(c - '0');
+        *value = next > ANSI_MAX_PARAM_VALUE ? ANSI_MAX_PARAM_VALUE : (uint16_t)next;
+    } else if (ansi_param_count < ANSI_MAX_PARAMS) {
+        ansi_params[ansi_param_count++] = 0;
+    }
+}
+
+/*
+ * Reads a 38/48 color starting at ansi_params[*index], either ;5;n from
+ * the 256-color palette or ;2;r;g;b, and leaves *index on its last
+ * parameter.
+ */
+static bool ansi_extended_color(size_t *index, uint32_t *rgb) {
+    size_t i = *index;
+    if (i + 2 < ansi_param_count && ansi_params[i + 1] == 5) {
+        *rgb = color_256(ansi_params[i + 2] < 256 ? ansi_params[i + 2] : 255);
+        *index = i + 2;
+        return true;
+    }
+    if (i + 4 < ansi_param_count && ansi_params[i + 1] == 2) {
+        uint32_t channels[3];
+        for (size_t c = 0; c < 3; c++) {
+            channels[c] = ansi_params[i + 2 + c] < 256 ? ansi_params[i + 2 + c] : 255;
+        }
+        *rgb = channels[0] << 16 | channels[1] << 8 | channels[2];
+        *index = i + 4;
+        return true;
+    }
+    *index = ansi_param_count;
+    return false;
+}
+
+static void select_graphic_rendition(void) {
+    if (ansi_param_count == 0) {
+        reset_attributes();
+        return;
+    }
+
+    for (size_t i = 0; i < ansi_param_count; i++) {
+        size_t p = ansi_params[i];
+        uint32_t rgb;
+        if (p == 0) {
+            text_foreground = default_foreground;
+            text_background = default_background;
+            text_foreground_index = -1;
+            text_bold = false;
+            text_reverse = false;
+        } else if (p == 1) {
+            text_bold = true;
+        } else if (p == 22) {
+            text_bold = false;
+        } else if (p == 7) {
+            text_reverse = true;
+        } else if (p == 27) {
+            text_reverse = false;
+        } else if (p >= 30 && p <= 37) {
+            text_foreground = ansi_palette[p - 30];
+            text_foreground_index = (int)(p - 30);
+        } else if (p == 38) {
+            if (ansi_extended_color(&i, &rgb)) {
+                text_foreground = rgb;
+                text_foreground_index = -1;
+            }
+        } else if (p == 39) {
+            text_foreground = default_foreground;
+            text_foreground_index = -1;
+        } else if (p >= 40 && p <= 47) {
+            text_background = ansi_palette[p - 40];
+        } else if (p == 48) {
+            if (ansi_extended_color(&i, &rgb)) {
+                text_background = rgb;
+            }
+        } else if (p == 49) {
+            text_background = default_background;
+        } else if (p >= 90 && p <= 97) {
+            text_foreground = ansi_palette[p - 90 + 8];
+            text_foreground_index = -1;
+        } else if (p >= 100 && p <= 107) {
+            text_background = ansi_palette[p - 100 + 8];
+        }
+    }
+    apply_attributes();
+}
+
+static void move_cursor(size_t row, size_t col) {
+    terminal_row = row < rows ? row : rows - 1;
+    terminal_column = col < columns ? col : columns - 1;
+}
+
+/* Vertical moves stop at the scroll region margins when starting inside it. */
+static void move_cursor_up(size_t count) {
+    size_t limit = terminal_row >= region_top ? region_top : 0;
+    terminal_row = terminal_row - limit > count ? terminal_row - count : limit;
+}
+
+static void move_cursor_down(size_t count) {
+    size_t limit = terminal_row <= region_bottom ? region_bottom : rows - 1;
+    terminal_row = limit - terminal_row > count ? terminal_row + count : limit;
+}
+
+static void erase_in_display(size_t mode) {
+    switch (mode) {
+        case 0:
+            erase_cells(terminal_row, terminal_column, columns);
+            for (size_t row = terminal_row + 1; row < rows; row++) {
+                erase_cells(row, 0, columns);
+            }
+            break;
+        case 1:
+            for (size_t row = 0; row < terminal_row; row++) {
+                erase_cells(row, 0, columns);
+            }
+            erase_cells(terminal_row, 0, terminal_column + 1);
+            break;
+        case 3:
+            history_filled = rows;
+            /* fall through */
+        case 2:
+            for (size_t row = 0; row < rows; row++) {
+                erase_cells(row, 0, columns);
+            }
+            break;
+    }
+}
+
+static void erase_in_line(size_t mode) {
+    switch (mode) {
+        case 0:
+            erase_cells(terminal_row, terminal_column, columns);
+            break;
+        case 1:
+            erase_cells(terminal_row, 0, terminal_column + 1);
+            break;
+        case 2:
+            erase_cells(terminal_row, 0, columns);
+            break;
+    }
+}
+
+/* Insert and delete line move the part of the scroll region below the cursor. */
+static void scroll_from_cursor(size_t count, bool down) {
+    if (terminal_row < region_top || terminal_row > region_bottom) return;
+
+    if (down) {
+        scroll_rows_down(terminal_row, region_bottom, count);
+    } else {
+        scroll_rows_up(terminal_row, region_bottom, count);
+    }
+    terminal_column = 0;
+}
+
+static void set_scroll_region(size_t top, size_t bottom) {
+    if (bottom > rows) bottom = rows;
+    if (top >= bottom) return;
+    region_top = top - 1;
+    region_bottom = bottom - 1;
+    move_cursor(0, 0);
+}
+
+static void ansi_reset(void) {
+    ansi_current = ANSI_GROUND;
+    ansi_param_count = 0;
+    ansi_private = false;
+    region_top = 0;
+    region_bottom = rows ? rows - 1 : 0;
+    saved_row = 0;
+    saved_column = 0;
+    reset_attributes();
+}
+
+static void csi_dispatch(char final) {
+    /* DEC private modes such as cursor visibility have nothing to act on. */
+    if (ansi_private) return;
+
+    size_t n = ansi_param(0, 1);
+    switch (final) {
+        case 'A': move_cursor_up(n); break;
+        case 'B': case 'e': move_cursor_down(n); break;
+        case 'C': case 'a': move_cursor(terminal_row, terminal_column + n); break;
+        case 'D': terminal_column = terminal_column > n ? terminal_column - n : 0; break;
+        case 'E': move_cursor_down(n); terminal_column = 0; break;
+        case 'F': move_cursor_up(n); terminal_column = 0; break;
+        case 'G': case '`': move_cursor(terminal_row, n - 1); break;
+        case 'd': move_cursor(n - 1, terminal_column); break;
+        case 'H': case 'f': move_cursor(n - 1, ansi_param(1, 1) - 1); break;
+        case 'J': erase_in_display(ansi_param(0, 0)); break;
+        case 'K': erase_in_line(ansi_param(0, 0)); break;
+        case 'X': erase_cells(terminal_row, terminal_column,
+                              columns - terminal_column > n ? terminal_column + n : columns); break;
+        case 'L': scroll_from_cursor(n, true); break;
+        case 'M': scroll_from_cursor(n, false); break;
+        case 'S': scroll_up(n); break;
+        case 'T': scroll_down(n); break;
+        case 'm': select_graphic_rendition(); break;
+        case 'r': set_scroll_region(ansi_param(0, 1), ansi_param(1, rows)); break;
+        case 's': saved_row = terminal_row; saved_column = terminal_column; break;
+        case 'u': move_cursor(saved_row, saved_column); break;
+    }
+}
+
+static void esc_dispatch(char final) {
+    switch (final) {
+        case '7': saved_row = terminal_row; saved_column = terminal_column; break;
+        case '8': move_cursor(saved_row, saved_column); break;
+        case 'D': line_feed(); break;
+        case 'E': terminal_column = 0; line_feed(); break;
+        case 'M': reverse_line_feed(); break;
+        case 'c':
+            ansi_reset();
+            erase_in_display(2);
+            move_cursor(0, 0);
+            break;
+    }
+}
+
+static void ansi_feed(char c) {
+    uint8_t entry = ansi.transition[ansi_current][ansi.byte_class[(unsigned char)c]];
+    ansi_current = entry & 0x0F;
+
+    switch ((ansi_action)(entry >> 4)) {
+        case ANSI_NONE:
+            break;
+        case ANSI_PRINT:
+        case ANSI_EXECUTE:
+            terminal_write_text(&c, 1);
+            break;
+        case ANSI_CLEAR:
+            ansi_param_count = 0;
+            ansi_private = false;
+            break;
+        case ANSI_PARAM:
+            ansi_collect(c);
+            break;
+        case ANSI_MARK_PRIVATE:
+            ansi_private = true;
+            break;
+        case ANSI_ESC_DISPATCH:
+            esc_dispatch(c);
+            break;
+        case ANSI_CSI_DISPATCH:
+            csi_dispatch(c);
+            break;
+    }
+}
+
+/*
+ * Shows the screen as it was lines rows of output ago; 0 returns to live
+ * output. Any new output also returns to live output.
+ */
+void terminal_scrollback(size_t lines) {
+    if (!framebuffer) return;
+
+    size_t available = history_filled - rows;
+    if (lines > available) lines = available;
+    if (lines != view_offset) {
+        view_offset = lines;
+        damage_all();
+    }
+    terminal_flush();
+}
+
+static void terminal_auto_flush(bool newline) {
+    if (flush_policy == TERMINAL_FLUSH_IMMEDIATE ||
+        (flush_policy == TERMINAL_FLUSH_NEWLINE && newline)) {
+        terminal_flush();
+    }
+}
+
+static void leave_scrollback(void) {
+    if (view_offset) {
+        view_offset = 0;
+        damage_all();
+    }
+}
+
+void terminal_putchar(char c) {
+    terminal_write(&c, 1);
+}
+
+void terminal_write(const char* data, size_t size) {
+    if (!framebuffer || !rows || !columns) return;
+
+    leave_scrollback();
+
+    /* Only escape sequences go through the parser; the text between them is written in runs. */
+    size_t i = 0;
+    while (i < size) {
+        if (ansi_current == ANSI_GROUND) {
+            const char *escape = (const char*)memchr(data + i, 0x1B, size - i);
+            size_t run = escape ? (size_t)(escape - (data + i)) : size - i;
+            if (run) {
+                terminal_write_text(data + i, run);
+                i += run;
+                if (i == size) break;
+            }
+        }
+        ansi_feed(data[i++]);
+    }
+
+    terminal_auto_flush(memchr(data, '\n', size) != NULL);
+}
+
+/*
+ * Moves the console onto a RAM back buffer. The framebuffer is read once
+ * here to seed the shadow copy; after that it is only written to.
+ */
+int terminal_enable_back_buffer(void) {
+    if (!framebuffer || shadow) return shadow != NULL;
+
+    size_t height = framebuffer->height;
+    size_t shadow_size = framebuffer->pitch * height;
+    uint8_t *buffer = (uint8_t*)vmm()->vmalloc(shadow_size + 2 * height * sizeof(uint32_t));
+    if (!buffer) {
+        printf("TERMINAL: Failed to allocate back buffer\n");
+        return 0;
+    }
+
+    memcpy(buffer, framebuffer->address, shadow_size);
+    dirty_left = (uint32_t*)(buffer + shadow_size);
+    dirty_right = dirty_left + height;
+    for (size_t y = 0; y < height; y++) {
+        dirty_left[y] = UINT32_MAX;
+        dirty_right[y] = 0;
+    }
+    dirty_top = height;
+    dirty_bottom = 0;
+    dirty_all = false;
+    shadow = buffer;
+    return 1;
+}
+
+void terminal_set_flush_policy(terminal_flush_policy policy) {
+    flush_policy = policy;
+    if (policy == TERMINAL_FLUSH_IMMEDIATE) {
+        terminal_flush();
+    }
+}
+
+void terminal_flush(void) {
+    if (!framebuffer) return;
+
+    render();
+    if (!shadow || dirty_top >= dirty_bottom) return;
+
+    uint8_t *fb = (uint8_t*)framebuffer->address;
+    uint64_t pitch = framebuffer->pitch;
+    size_t bytes_per_pixel = renderer->bytes_per_pixel;
+
+    if (dirty_all) {
+        size_t size = framebuffer->height * pitch;
+        if (size >= MEM_NT_THRESHOLD) {
+            memcpy_nt(fb, shadow, size);
+        } else {
+            memcpy(fb, shadow, size);
+        }
+    } else {
+        for (size_t y = dirty_top; y < dirty_bottom; y++) {
+            if (dirty_left[y] >= dirty_right[y]) continue;
+            size_t offset = y * pitch + dirty_left[y] * bytes_per_pixel;
+            memcpy(fb + offset, shadow + offset, (dirty_right[y] - dirty_left[y]) * bytes_per_pixel);
+        }
+    }
+
+    reset_dirty();
 }
 
 void terminal_writestring(const char* data) {
@@ -172,11 +1030,8 @@ void terminal_set_cursor_pos(size_t x, size_t y) {
     terminal_column = x;
     terminal_row = y;
     
-    size_t max_cols = framebuffer->width / FONT_WIDTH;
-    size_t max_rows = framebuffer->height / FONT_HEIGHT;
-    
-    if (terminal_column >= max_cols) terminal_column = max_cols - 1;
-    if (terminal_row >= max_rows) terminal_row = max_rows - 1;
+    if (terminal_column >= columns) terminal_column = columns - 1;
+    if (terminal_row >= rows) terminal_row = rows - 1;
 }
 
 size_t terminal_get_cursor_x(void) {
@@ -188,13 +1043,21 @@ size_t terminal_get_cursor_y(void) {
 }
 
 size_t terminal_get_width(void) {
-    return framebuffer ? framebuffer->width / FONT_WIDTH : 0;
+    return columns;
 }
 
 size_t terminal_get_height(void) {
-    return framebuffer ? framebuffer->height / FONT_HEIGHT : 0;
+    return rows;
+}
+
+static void terminal_sink(void *ctx, const char *data, size_t size) {
+    (void)ctx;
+    terminal_write(data, size);
 }
 
 void terminal_printf(const char* format, ...) {
-    terminal_writestring(format);
+    va_list args;
+    va_start(args, format);
+    vcbprintf(terminal_sink, NULL, format, args);
+    va_end(args);
 }
\ No newline at end of file
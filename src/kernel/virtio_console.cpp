@@ -0,0 +1,180 @@
+#include <kernel/virtio.h>
+#include <kernel/pci.h>
+#include <kernel/cpu.h>
+#include <kernel/interrupt.h>
+#include <kernel/memory.h>
+#include <stdio.h>
+#include <string.h>
+
+/* Descriptors actually used, however large a queue the device offers. */
+#define VIRTIO_CONSOLE_MAX_DESCRIPTORS 256
+
+static uint16_t io_base = 0;
+static uint16_t queue_size = 0;
+static vring_desc *desc = NULL;
+static vring_avail *avail = NULL;
+static vring_used *used = NULL;
+static uint16_t avail_idx = 0;
+static uint16_t used_idx = 0;
+
+static uint16_t free_ids[VIRTIO_CONSOLE_MAX_DESCRIPTORS];
+static size_t free_count = 0;
+static size_t in_flight = 0;
+
+static char *buffer = NULL;
+static uint64_t buffer_phys = 0;
+static size_t buffer_pos = 0;
+
+static bool ready = false;
+static int lock_word = 0;
+
+static void *alloc_zeroed(size_t size, uint64_t *phys) {
+    size_t pages = (size + PAGE_SIZE - 1) / PAGE_SIZE;
+    *phys = pmm()->allocBlocks(pages);
+    if (!*phys) return NULL;
+
+    void *virt = vmm()->physicalToVirtual(*phys);
+    memset(virt, 0, pages * PAGE_SIZE);
+    return virt;
+}
+
+/*
+ * Sets up the transmit queue of the first virtio console. Only the
+ * legacy I/O port interface is supported, and no features are
+ * negotiated, so the device has a single port and no control queue.
+ */
+int virtio_console_initialize(void) {
+    pci_device dev;
+    if (!pci_find_device(VIRTIO_VENDOR_ID, VIRTIO_CONSOLE_DEVICE_ID, &dev)) {
+        printf("VIRTIO: No console device found\n");
+        return 0;
+    }
+
+    uint32_t bar = pci_read32(&dev, PCI_BAR0);
+    if (!(bar & PCI_BAR_IO)) {
+        printf("VIRTIO: Console has no legacy I/O interface\n");
+        return 0;
+    }
+    io_base = (uint16_t)(bar & PCI_BAR_IO_MASK);
+    pci_enable(&dev, PCI_COMMAND_IO | PCI_COMMAND_MASTER);
+
+    outb(io_base + VIRTIO_PCI_STATUS, 0);
+    outb(io_base + VIRTIO_PCI_STATUS, VIRTIO_STATUS_ACKNOWLEDGE);
+    outb(io_base + VIRTIO_PCI_STATUS, VIRTIO_STATUS_ACKNOWLEDGE | VIRTIO_STATUS_DRIVER);
+    outl(io_base + VIRTIO_PCI_GUEST_FEATURES, 0);
+
+    outw(io_base + VIRTIO_PCI_QUEUE_SELECT, VIRTIO_CONSOLE_TX_QUEUE);
+    queue_size = inw(io_base + VIRTIO_PCI_QUEUE_SIZE);
+    if (queue_size == 0) {
+        printf("VIRTIO: Console transmit queue is unavailable\n");
+        outb(io_base + VIRTIO_PCI_STATUS, VIRTIO_STATUS_FAILED);
+        return 0;
+    }
+
+    uint64_t ring_phys;
+    uint8_t *ring = (uint8_t*)alloc_zeroed(vring_size(queue_size), &ring_phys);
+    buffer = (char*)alloc_zeroed(VIRTIO_CONSOLE_BUFFER_SIZE, &buffer_phys);
+    if (!ring || !buffer) {
+        printf("VIRTIO: Failed to allocate console queue\n");
+        outb(io_base + VIRTIO_PCI_STATUS, VIRTIO_STATUS_FAILED);
+        return 0;
+    }
+
+    desc = (vring_desc*)ring;
+    avail = (vring_avail*)(ring + sizeof(vring_desc) * queue_size);
+    size_t used_offset = sizeof(vring_desc) * queue_size + sizeof(uint16_t) * (3 + queue_size);
+    used_offset = (used_offset + VIRTIO_PCI_VRING_ALIGN - 1) & ~(size_t)(VIRTIO_PCI_VRING_ALIGN - 1);
+    used = (vring_used*)(ring + used_offset);
+
+    /* The device never interrupts us; used buffers are reclaimed on the next write. */
+    avail->flags = 1;
+
+    free_count = queue_size < VIRTIO_CONSOLE_MAX_DESCRIPTORS ? queue_size : VIRTIO_CONSOLE_MAX_DESCRIPTORS;
+    for (size_t i = 0; i < free_count; i++) {
+        free_ids[i] = (uint16_t)i;
+    }
+
+    outl(io_base + VIRTIO_PCI_QUEUE_PFN, (uint32_t)(ring_phys / VIRTIO_PCI_VRING_ALIGN));
+    outb(io_base + VIRTIO_PCI_STATUS,
+         VIRTIO_STATUS_ACKNOWLEDGE | VIRTIO_STATUS_DRIVER | VIRTIO_STATUS_DRIVER_OK);
+    ready = true;
+    return 1;
+}
+
+/*
+ * Returns the descriptors the device has finished with. The staging
+ * buffer is only rewound once nothing is in flight, so completions can
+ * arrive in any order.
+ */
+static void reclaim(void) {
+    uint16_t idx = __atomic_load_n(&used->idx, __ATOMIC_ACQUIRE);
+    while (used_idx != idx) {
+        free_ids[free_count++] = (uint16_t)used->ring[used_idx % queue_size].id;
+        used_idx++;
+        in_flight--;
+    }
+    if (in_flight == 0) {
+        buffer_pos = 0;
+    }
+}
+
+static void notify(void) {
+    __atomic_store_n(&avail->idx, avail_idx, __ATOMIC_RELEASE);
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    if (!(__atomic_load_n(&used->flags, __ATOMIC_RELAXED) & VRING_USED_F_NO_NOTIFY)) {
+        outw(io_base + VIRTIO_PCI_QUEUE_NOTIFY, VIRTIO_CONSOLE_TX_QUEUE);
+    }
+}
+
+/*
+ * Copies the data into the staging buffer, one descriptor per chunk,
+ * and notifies the device once for the whole write. When the buffer or
+ * the descriptors run out, what is queued so far is sent and waited for.
+ */
+void virtio_console_write(const char *data, size_t size) {
+    if (!ready) return;
+
+    uint64_t flags = interrupt_save();
+    while (__atomic_exchange_n(&lock_word, 1, __ATOMIC_ACQUIRE)) {
+        __builtin_ia32_pause();
+    }
+
+    reclaim();
+    bool pending = false;
+    while (size) {
+        if (free_count == 0 || buffer_pos == VIRTIO_CONSOLE_BUFFER_SIZE) {
+            notify();
+            pending = false;
+            while (in_flight) {
+                __builtin_ia32_pause();
+                reclaim();
+            }
+        }
+
+        size_t chunk = size < VIRTIO_CONSOLE_CHUNK_SIZE ? size : VIRTIO_CONSOLE_CHUNK_SIZE;
+        if (chunk > VIRTIO_CONSOLE_BUFFER_SIZE - buffer_pos) {
+            chunk = VIRTIO_CONSOLE_BUFFER_SIZE - buffer_pos;
+        }
+        memcpy(buffer + buffer_pos, data, chunk);
+
+        uint16_t id = free_ids[--free_count];
+        desc[id].addr = buffer_phys + buffer_pos;
+        desc[id].len = (uint32_t)chunk;
+        desc[id].flags = 0;
+        desc[id].next = 0;
+        avail->ring[avail_idx % queue_size] = id;
+        avail_idx++;
+        in_flight++;
+
+        buffer_pos += chunk;
+        data += chunk;
+        size -= chunk;
+        pending = true;
+    }
+    if (pending) {
+        notify();
+    }
+
+    __atomic_store_n(&lock_word, 0, __ATOMIC_RELEASE);
+    interrupt_restore(flags);
+}